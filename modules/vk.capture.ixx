@@ -0,0 +1,52 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module vk.capture;
+
+import vk.camera;
+import vk.context;
+import vk.frame;
+import vk.swapchain;
+import std;
+
+namespace vk::capture {
+
+    // Raw: one tightly packed RGBA8 file per frame. Ppm: one binary P6 file per frame.
+    // Y4m: a single 4:4:4 YUV4MPEG2 stream holding every frame.
+    export enum class ImageSequenceFormat : std::uint8_t { Raw, Ppm, Y4m };
+
+    export struct TrajectoryDesc {
+        std::span<const camera::CameraState> poses{};
+        camera::CameraConfig camera{};
+        Extent2D extent{1920, 1080};
+        uint32_t frames_in_flight{3};
+        ImageSequenceFormat format{ImageSequenceFormat::Ppm};
+        std::filesystem::path output{}; // directory for Raw/Ppm, file for Y4m
+        std::string prefix{"frame_"}; // Raw/Ppm file names: <prefix><pose index, 6 digits>.<ext>
+        uint32_t y4m_fps{30};
+        std::size_t max_queued_frames{16}; // writer backlog before rendering blocks
+    };
+
+    // Handed to the record callback for every pose. The callback records into
+    // frame::cmd(frames, frame_index), renders into target.images[image_index] and must
+    // leave frames.swapchain_image_layout[image_index] describing the image's final layout.
+    export struct TrajectoryFrame {
+        frame::FrameSystem& frames;
+        const swapchain::Swapchain& target;
+        uint32_t frame_index;
+        uint32_t image_index;
+        uint32_t pose_index;
+        const camera::CameraMatrices& camera;
+    };
+
+    export struct CaptureReport {
+        uint32_t frames{0};
+        double seconds{0.0}; // first frame to the last byte written
+        double fps{0.0};
+        std::uint64_t bytes_written{0};
+    };
+
+    // Renders every pose offscreen, without presentation or vsync, and streams the frames
+    // to disk on a background thread. Blocks until all frames are written.
+    export [[nodiscard]] CaptureReport render_trajectory(const context::VulkanContext& vkctx, const TrajectoryDesc& desc, const std::function<void(TrajectoryFrame&)>& record);
+
+} // namespace vk::capture
@@ -3,6 +3,7 @@ module;
 
 #include <vulkan/vulkan_raii.hpp>
 export module vk.context;
+import vk.memory;
 import std;
 
 
@@ -17,6 +18,22 @@ namespace vk::context {
         uint32_t graphics_queue_index{0};
         raii::CommandPool command_pool{nullptr};
 
+        // Dedicated transfer-only / async-compute families when the device has them,
+        // otherwise these alias the graphics queue. Each has its own command pool.
+        raii::Queue transfer_queue{nullptr};
+        uint32_t transfer_queue_index{0};
+        raii::CommandPool transfer_command_pool{nullptr};
+        raii::Queue compute_queue{nullptr};
+        uint32_t compute_queue_index{0};
+        raii::CommandPool compute_command_pool{nullptr};
+
+        // VK_EXT_extended_dynamic_state3 polygon mode; see pipeline::GraphicsPipelineDesc::dynamic_polygon_mode.
+        bool dynamic_polygon_mode{false};
+
+        memory::Allocator allocator{};
+        memory::StagingRing staging{};
+        memory::TransferBatcher transfer{};
+
         VulkanContext()                                    = default;
         ~VulkanContext()                                   = default;
         VulkanContext(const VulkanContext&)                = delete;
@@ -40,4 +57,19 @@ namespace vk::context {
     };
 
     export [[nodiscard]] std::pair<VulkanContext, SurfaceContext> setup_vk_context_glfw(const std::string& app_name, const std::string& engine_name);
+    // No window, no surface and no swapchain extension; validation is enabled only when
+    // requested and the layer is installed. Pair with swapchain::setup_offscreen().
+    export [[nodiscard]] VulkanContext setup_vk_context_headless(const std::string& app_name, const std::string& engine_name, bool enable_validation = false);
+
+    export [[nodiscard]] bool has_dedicated_transfer_queue(const VulkanContext& vkctx);
+    export [[nodiscard]] bool has_async_compute_queue(const VulkanContext& vkctx);
+
+    // Queue family ownership transfer for exclusive-sharing resources. The release half is
+    // recorded on the source queue and the acquire half on the destination queue, which must
+    // wait on a semaphore signaled after the release. When both families are the same the
+    // release is a no-op and the acquire only performs the requested layout transition.
+    export void release_buffer_ownership(const raii::CommandBuffer& cmd, Buffer buffer, DeviceSize offset, DeviceSize size, uint32_t src_family, uint32_t dst_family, PipelineStageFlags2 src_stage, AccessFlags2 src_access);
+    export void acquire_buffer_ownership(const raii::CommandBuffer& cmd, Buffer buffer, DeviceSize offset, DeviceSize size, uint32_t src_family, uint32_t dst_family, PipelineStageFlags2 dst_stage, AccessFlags2 dst_access);
+    export void release_image_ownership(const raii::CommandBuffer& cmd, Image image, const ImageSubresourceRange& range, ImageLayout old_layout, ImageLayout new_layout, uint32_t src_family, uint32_t dst_family, PipelineStageFlags2 src_stage, AccessFlags2 src_access);
+    export void acquire_image_ownership(const raii::CommandBuffer& cmd, Image image, const ImageSubresourceRange& range, ImageLayout old_layout, ImageLayout new_layout, uint32_t src_family, uint32_t dst_family, PipelineStageFlags2 dst_stage, AccessFlags2 dst_access);
 } // namespace vk::context
@@ -3,24 +3,211 @@ module;
 export module vk.frame;
 
 import vk.context;
+import vk.memory;
 import vk.swapchain;
 import std;
 
 namespace vk::frame {
 
+    // Per-frame bump allocator over a persistently mapped buffer. It is rewound in
+    // begin_frame() once the frame's fence has signaled, so slices live for one frame.
+    export struct TransientArena {
+        memory::MappedBuffer buffer{};
+        DeviceSize head{0};
+        DeviceSize high_water{0};
+    };
+
+    export struct TransientSlice {
+        Buffer buffer{};
+        DeviceSize offset{0};
+        DeviceSize size{0};
+        std::byte* mapped{nullptr};
+    };
+
+    // Objects handed over by retire() are destroyed once the frame that last used them,
+    // or the timeline point they wait on, has completed on the GPU.
+    export struct DeletionQueue {
+        struct Entry {
+            std::uint64_t frame_serial{0};
+            memory::TransferTicket ticket{};
+            std::shared_ptr<void> object{};
+        };
+
+        std::deque<Entry> entries{};
+    };
+
+    // Fences: one binary fence per frame slot. Timeline: one timeline semaphore whose
+    // value is the serial of the last completed frame; other queues may wait on it.
+    export enum class PacingMode : std::uint8_t {
+        Fences,
+        Timeline,
+    };
+
+    // One pool per frame slot and worker thread. Workers only touch their own entry, so
+    // recording needs no locks; the pool is reset as a whole when the slot is reused.
+    export struct WorkerCommands {
+        raii::CommandPool pool{nullptr};
+        std::deque<raii::CommandBuffer> secondaries{}; // grown on demand, reused across frames; a deque keeps handed-out references valid
+        uint32_t used{0};
+    };
+
+    // Attachment formats of the dynamic rendering instance the secondaries execute in.
+    export struct RenderingInheritance {
+        std::span<const Format> color_formats{};
+        Format depth_format{Format::eUndefined};
+        Format stencil_format{Format::eUndefined};
+        SampleCountFlagBits samples{SampleCountFlagBits::e1};
+    };
+
+    export struct GpuScopeResult {
+        std::string name;
+        uint32_t depth{0};
+        int32_t parent{-1}; // index into the same result vector, -1 for roots
+        double ms{0.0};
+    };
+
+    // Timestamp queries per frame slot. Results are read in begin_frame once the slot's
+    // previous submission has retired, so reading never stalls the GPU.
+    export struct GpuProfiler {
+        struct Scope {
+            std::string name;
+            uint32_t depth{0};
+            int32_t parent{-1};
+            bool closed{false};
+        };
+
+        std::vector<raii::QueryPool> pools; // per-frame, two queries per scope
+        std::vector<std::vector<Scope>> scopes; // per-frame
+        std::vector<std::vector<int32_t>> open; // per-frame stack of open scopes
+        uint32_t max_scopes{0};
+        double ns_per_tick{1.0};
+        std::uint64_t valid_mask{~0ull};
+
+        std::vector<GpuScopeResult> last{}; // most recently completed frame, in begin order
+        std::map<std::string, double, std::less<>> average_ms{};
+        double smoothing{0.1}; // weight of the newest sample in average_ms
+    };
+
+    export enum class FramePhase : std::uint8_t {
+        Wait, // fence / timeline waits in begin_frame
+        Acquire, // acquireNextImage
+        Record, // from begin_frame returning to end_frame
+        Submit, // queue submission in end_frame
+        Present, // presentKHR
+        Frame, // begin_frame to begin_frame
+        Limit, // frame limiter sleep at the start of begin_frame
+        PresentInterval, // presentKHR to presentKHR; matches the refresh interval under FIFO
+        Count,
+    };
+
+    export inline constexpr std::size_t frame_phase_count = static_cast<std::size_t>(FramePhase::Count);
+
+    export struct FrameTiming {
+        std::array<float, frame_phase_count> ms{};
+    };
+
+    // Fixed-size ring written by the render thread and readable from any thread. Each
+    // slot is guarded by a sequence counter, so readers skip samples being overwritten.
+    export struct FrameStats {
+        static constexpr std::uint32_t capacity = 1024;
+
+        struct Slot {
+            std::atomic<std::uint64_t> seq{0};
+            std::array<std::atomic<float>, frame_phase_count> ms{};
+        };
+
+        std::array<Slot, capacity> slots{};
+        std::atomic<std::uint64_t> written{0};
+    };
+
+    export struct FrameHistogram {
+        float bucket_ms{1.0f};
+        std::vector<std::uint32_t> counts{};
+        std::uint32_t overflow{0};
+        std::uint32_t samples{0};
+    };
+
+    // A completed readback. For the callback, `pixels` points into the mapped ring slot
+    // and is only valid during the call.
+    export struct ReadbackView {
+        std::uint64_t frame_serial{0};
+        Extent2D extent{};
+        Format format{};
+        std::span<const std::byte> pixels{};
+    };
+
+    export struct ReadbackFrame {
+        std::uint64_t frame_serial{0};
+        Extent2D extent{};
+        Format format{};
+        std::vector<std::byte> pixels{};
+    };
+
+    // Copies of the frame's color target into per-frame host buffers. A slot is read in
+    // begin_frame after its fence wait, so results arrive frames_in_flight frames later.
+    export struct FrameReadback {
+        struct Pending {
+            bool active{false};
+            std::uint64_t frame_serial{0};
+            Extent2D extent{};
+            Format format{};
+            DeviceSize bytes{0};
+        };
+
+        std::vector<memory::MappedBuffer> buffers; // per-frame, grown on demand
+        std::vector<Pending> pending; // per-frame
+        std::function<void(const ReadbackView&)> on_ready{}; // when empty, results queue for poll_readback()
+        std::deque<ReadbackFrame> ready{};
+        std::size_t max_ready{8}; // oldest results are dropped beyond this
+    };
+
+    // CPU-side cap on the frame rate, applied at the start of begin_frame. Deadlines advance by
+    // a fixed interval without catching up, so a slow frame does not cause a burst afterwards.
+    export struct FrameLimiter {
+        std::chrono::nanoseconds interval{0}; // 0: unlimited
+        std::chrono::steady_clock::time_point next{};
+    };
+
     export struct FrameSystem {
         uint32_t frames_in_flight = 0;
 
+        std::vector<raii::CommandPool> command_pools; // per-frame, reset whole in begin_frame
         std::vector<raii::CommandBuffer> command_buffers;
 
+        uint32_t worker_count{0};
+        std::vector<WorkerCommands> workers; // [frame_index * worker_count + worker]
+
         std::vector<raii::Semaphore> image_acquired; // per-frame
         std::vector<raii::Fence> in_flight; // per-frame
 
         std::vector<raii::Semaphore> render_finished; // per-image
         std::vector<uint32_t> image_in_flight_frame;
+        std::vector<std::uint64_t> image_serial; // per-image, timeline pacing
+        uint32_t next_offscreen_image{0}; // round-robin index for offscreen chains
 
         std::vector<ImageLayout> swapchain_image_layout;
 
+        std::vector<TransientArena> transient; // per-frame
+        DeviceSize transient_alignment{256}; // satisfies uniform and storage dynamic offsets
+
+        std::uint64_t frame_serial{0}; // frames begun so far; the current frame's serial
+        std::uint64_t completed_serial{0}; // newest frame known to have finished on the GPU
+        std::vector<std::uint64_t> slot_serial; // per-frame: serial last recorded into the slot
+        DeletionQueue deletion{};
+
+        GpuProfiler profiler{};
+        FrameReadback readback{};
+
+        std::unique_ptr<FrameStats> stats{};
+        FrameTiming timing{}; // the frame being recorded
+        std::chrono::steady_clock::time_point frame_begin{};
+        std::chrono::steady_clock::time_point record_begin{};
+        std::chrono::steady_clock::time_point last_present{};
+        FrameLimiter limiter{};
+
+        PacingMode pacing{PacingMode::Fences};
+        raii::Semaphore frame_timeline{nullptr}; // signaled with frame_serial on submit
+
         FrameSystem()                                  = default;
         ~FrameSystem()                                 = default;
         FrameSystem(FrameSystem&&) noexcept            = default;
@@ -34,13 +221,67 @@ namespace vk::frame {
         uint32_t image_index{0};
     };
 
-    export [[nodiscard]] FrameSystem create_frame_system(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, uint32_t frames_in_flight);
+    export [[nodiscard]] FrameSystem create_frame_system(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, uint32_t frames_in_flight, DeviceSize transient_bytes_per_frame = 4ull << 20, PacingMode pacing = PacingMode::Fences);
     export void on_swapchain_recreated(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, FrameSystem& frames);
+    // Recreates the swapchain and retires the old one through the deletion queue instead of
+    // waiting for the device to go idle.
+    export void recreate_swapchain(const context::VulkanContext& vkctx, context::SurfaceContext& sctx, swapchain::Swapchain& sc, FrameSystem& frames);
 
     export [[nodiscard]] AcquireResult begin_frame(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, FrameSystem& frames, uint32_t frame_index);
     export void begin_commands(FrameSystem& frames, uint32_t frame_index);
+
+    export void enable_parallel_recording(const context::VulkanContext& vkctx, FrameSystem& frames, uint32_t worker_count);
+    export [[nodiscard]] const raii::CommandBuffer& begin_secondary(const context::VulkanContext& vkctx, FrameSystem& frames, uint32_t frame_index, uint32_t worker, const RenderingInheritance& inheritance);
+    export void execute_secondaries(FrameSystem& frames, uint32_t frame_index);
+
+    export [[nodiscard]] std::vector<FrameTiming> frame_timings(const FrameSystem& frames, std::uint32_t window = FrameStats::capacity);
+    export [[nodiscard]] float frame_percentile(const FrameSystem& frames, FramePhase phase, float percentile, std::uint32_t window = FrameStats::capacity);
+    export void set_frame_limit(FrameSystem& frames, double max_fps); // 0 disables the limiter
+    export [[nodiscard]] FrameHistogram frame_histogram(const FrameSystem& frames, FramePhase phase, float bucket_ms, std::uint32_t bucket_count, std::uint32_t window = FrameStats::capacity);
+
+    export void enable_readback(FrameSystem& frames, std::function<void(const ReadbackView&)> on_ready = {});
+    export void record_readback(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, FrameSystem& frames, uint32_t frame_index, uint32_t image_index);
+    export [[nodiscard]] std::optional<ReadbackFrame> poll_readback(FrameSystem& frames);
+    // Waits for every frame with a pending readback and delivers the results in frame order.
+    export void flush_readbacks(const context::VulkanContext& vkctx, FrameSystem& frames);
+
+    export void enable_gpu_profiler(const context::VulkanContext& vkctx, FrameSystem& frames, uint32_t max_scopes = 256);
+    export void profile_begin(FrameSystem& frames, uint32_t frame_index, std::string_view name);
+    export void profile_end(FrameSystem& frames, uint32_t frame_index);
+    export [[nodiscard]] std::span<const GpuScopeResult> gpu_timings(const FrameSystem& frames);
     export [[nodiscard]] bool end_frame(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, FrameSystem& frames, uint32_t frame_index, uint32_t image_index, const std::span<const vk::SemaphoreSubmitInfo> extra_waits = {});
 
+    export [[nodiscard]] TransientSlice allocate_transient(FrameSystem& frames, uint32_t frame_index, DeviceSize size, DeviceSize alignment = 0);
+    export [[nodiscard]] TransientSlice push_transient(FrameSystem& frames, uint32_t frame_index, std::span<const std::byte> bytes, DeviceSize alignment = 0);
+
+    export [[nodiscard]] bool is_frame_complete(FrameSystem& frames, std::uint64_t serial);
+    export void wait_frame(const context::VulkanContext& vkctx, FrameSystem& frames, std::uint64_t serial);
+    export [[nodiscard]] memory::TransferTicket frame_ticket(const FrameSystem& frames, std::uint64_t serial);
+
+    export template <typename T>
+    void retire(FrameSystem& frames, T&& object);
+    export template <typename T>
+    void retire_after(FrameSystem& frames, const memory::TransferTicket& ticket, T&& object);
+    export void collect_retired(const context::VulkanContext& vkctx, FrameSystem& frames);
+    export void flush_retired(FrameSystem& frames);
+
     export [[nodiscard]] raii::CommandBuffer& cmd(FrameSystem& frames, uint32_t frame_index);
     export [[nodiscard]] const raii::CommandBuffer& cmd(const FrameSystem& frames, uint32_t frame_index);
 } // namespace vk::frame
+
+template <typename T>
+void vk::frame::retire(FrameSystem& frames, T&& object) {
+    frames.deletion.entries.push_back(DeletionQueue::Entry{
+        .frame_serial = frames.frame_serial,
+        .object       = std::make_shared<std::remove_cvref_t<T>>(std::forward<T>(object)),
+    });
+}
+
+template <typename T>
+void vk::frame::retire_after(FrameSystem& frames, const memory::TransferTicket& ticket, T&& object) {
+    frames.deletion.entries.push_back(DeletionQueue::Entry{
+        .frame_serial = frames.frame_serial,
+        .ticket       = ticket,
+        .object       = std::make_shared<std::remove_cvref_t<T>>(std::forward<T>(object)),
+    });
+}
@@ -0,0 +1,175 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module vk.graph;
+
+import vk.context;
+import vk.frame;
+import vk.memory;
+import std;
+
+namespace vk::graph {
+
+    // A per-frame render graph. Passes declare how they use images and buffers; compile()
+    // culls passes whose results are never consumed, places transient images with disjoint
+    // lifetimes in shared memory, and precomputes one batched barrier per pass. execute()
+    // records the barriers and pass callbacks and writes final layouts back to the caller's
+    // layout trackers (e.g. FrameSystem::swapchain_image_layout, Swapchain::depth_layout).
+    //
+    // Typical frame: reset(), import/create resources, add_pass()..., compile(), execute().
+    // Transient memory is kept across reset() and only rebuilt when the transient set changes.
+
+    export using ResourceId                      = uint32_t;
+    export constexpr ResourceId invalid_resource = 0xFFFF'FFFFu;
+
+    // Each use maps to a fixed stage/access/layout triple; see use_info().
+    export enum class Use : std::uint8_t {
+        ColorAttachment,
+        DepthAttachment,
+        DepthRead, // read-only depth test and/or fragment sampling
+        SampledFragment,
+        SampledCompute,
+        StorageRead, // compute
+        StorageWrite, // compute, read-modify-write
+        TransferSrc,
+        TransferDst,
+        VertexBuffer,
+        IndexBuffer,
+        UniformBuffer,
+        IndirectBuffer,
+        Present,
+    };
+
+    export struct UseInfo {
+        PipelineStageFlags2 stages{};
+        AccessFlags2 access{};
+        ImageLayout layout{ImageLayout::eUndefined};
+        ImageUsageFlags image_usage{};
+        bool writes{false};
+    };
+
+    export struct TransientImageDesc {
+        Extent2D extent{};
+        Format format{Format::eUndefined};
+        ImageAspectFlags aspect{ImageAspectFlagBits::eColor};
+        ImageUsageFlags extra_usage{}; // the usages implied by the passes are added automatically
+    };
+
+    export struct GraphResource {
+        std::string name{};
+        bool is_image{true};
+        bool imported{false};
+        bool output{false}; // keeps its writers alive even if no pass reads it
+
+        Image image{};
+        ImageView view{};
+        Extent2D extent{};
+        Format format{};
+        ImageAspectFlags aspect{ImageAspectFlagBits::eColor};
+        ImageLayout* tracked_layout{nullptr}; // imported images: read by compile(), written by execute()
+        ImageLayout final_layout{ImageLayout::eUndefined}; // imported images: eUndefined keeps the last use's layout
+        ImageLayout end_layout{ImageLayout::eUndefined}; // computed by compile()
+
+        Buffer buffer{};
+        DeviceSize offset{0};
+        DeviceSize size{WholeSize};
+
+        TransientImageDesc transient{};
+        uint32_t transient_index{invalid_resource};
+    };
+
+    export struct PassAccess {
+        ResourceId resource{invalid_resource};
+        Use use{Use::SampledFragment};
+    };
+
+    export struct RenderGraph;
+    export using PassFn = std::function<void(const raii::CommandBuffer&, const RenderGraph&)>;
+
+    export struct Pass {
+        std::string name{};
+        std::vector<PassAccess> accesses{};
+        PassFn execute{};
+        bool side_effects{false}; // never culled (readbacks, queries, ...)
+        bool live{false};
+    };
+
+    export struct BarrierBatch {
+        std::vector<ImageMemoryBarrier2> images{};
+        std::vector<BufferMemoryBarrier2> buffers{};
+    };
+
+    export struct TransientImage {
+        TransientImageDesc desc{};
+        ImageUsageFlags usage{};
+        DeviceSize offset{0}; // inside TransientStorage::block
+        DeviceSize size{0};
+        bool dedicated{false};
+        raii::Image image{nullptr};
+        raii::ImageView view{nullptr};
+    };
+
+    // Images are declared after their memory so they are destroyed first.
+    export struct TransientStorage {
+        memory::Allocation block{};
+        std::vector<memory::Allocation> dedicated{};
+        std::vector<TransientImage> images{};
+        std::uint64_t signature{0};
+
+        TransientStorage()                                       = default;
+        ~TransientStorage()                                      = default;
+        TransientStorage(TransientStorage&&) noexcept            = default;
+        TransientStorage& operator=(TransientStorage&&) noexcept = default;
+        TransientStorage(const TransientStorage&)                = delete;
+        TransientStorage& operator=(const TransientStorage&)     = delete;
+    };
+
+    export struct GraphStats {
+        uint32_t passes{0};
+        uint32_t culled_passes{0};
+        uint32_t barrier_batches{0}; // pipelineBarrier2 calls per execute()
+        uint32_t image_barriers{0};
+        uint32_t buffer_barriers{0};
+        DeviceSize transient_bytes{0}; // memory actually bound to transient images
+        DeviceSize transient_bytes_unaliased{0}; // what separate allocations would have needed
+    };
+
+    export struct RenderGraph {
+        std::vector<GraphResource> resources{};
+        std::vector<Pass> passes{};
+
+        std::vector<uint32_t> order{}; // live passes in submission order
+        std::vector<BarrierBatch> barriers{}; // per entry of order, recorded before the pass
+        BarrierBatch final_barriers{};
+        bool compiled{false};
+
+        TransientStorage transient{};
+        GraphStats stats{};
+
+        RenderGraph()                                  = default;
+        ~RenderGraph()                                 = default;
+        RenderGraph(RenderGraph&&) noexcept            = default;
+        RenderGraph& operator=(RenderGraph&&) noexcept = default;
+        RenderGraph(const RenderGraph&)                = delete;
+        RenderGraph& operator=(const RenderGraph&)     = delete;
+    };
+
+    export [[nodiscard]] UseInfo use_info(Use use);
+
+    export void reset(RenderGraph& graph);
+
+    export [[nodiscard]] ResourceId import_image(RenderGraph& graph, std::string_view name, Image image, ImageView view, Extent2D extent, Format format, ImageAspectFlags aspect, ImageLayout& tracked_layout, ImageLayout final_layout = ImageLayout::eUndefined);
+    export [[nodiscard]] ResourceId import_buffer(RenderGraph& graph, std::string_view name, Buffer buffer, DeviceSize offset = 0, DeviceSize size = WholeSize);
+    export [[nodiscard]] ResourceId create_image(RenderGraph& graph, std::string_view name, const TransientImageDesc& desc);
+    export void mark_output(RenderGraph& graph, ResourceId resource);
+
+    export uint32_t add_pass(RenderGraph& graph, std::string_view name, std::vector<PassAccess> accesses, PassFn execute, bool side_effects = false);
+
+    // Old transient storage is retired through the frame deletion queue when it is rebuilt.
+    export void compile(const context::VulkanContext& vkctx, frame::FrameSystem& frames, RenderGraph& graph);
+    export void execute(const RenderGraph& graph, const raii::CommandBuffer& cmd);
+
+    export [[nodiscard]] Image image(const RenderGraph& graph, ResourceId resource);
+    export [[nodiscard]] ImageView view(const RenderGraph& graph, ResourceId resource);
+    export [[nodiscard]] Buffer buffer(const RenderGraph& graph, ResourceId resource);
+    export [[nodiscard]] Extent2D extent(const RenderGraph& graph, ResourceId resource);
+} // namespace vk::graph
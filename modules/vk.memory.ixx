@@ -1,21 +1,211 @@
 module;
 #include <vulkan/vulkan_raii.hpp>
 export module vk.memory;
+import std;
 
 
 namespace vk::memory {
+    struct AllocatorState;
+
+    // Buffers and linear images must not share a bufferImageGranularity page with
+    // optimal-tiling images, so the allocator keeps them in separate blocks.
+    export enum class ResourceKind : std::uint8_t {
+        Linear,
+        Optimal,
+    };
+
+    export struct AllocatorDesc {
+        DeviceSize block_size{64ull << 20}; // preferred block size on large heaps
+        DeviceSize small_heap_limit{1ull << 30}; // heaps up to this size use heap_size / 8 blocks
+        bool keep_empty_block{true}; // keep one empty block per pool to avoid allocate/free thrash
+        bool use_memory_budget{false}; // VK_EXT_memory_budget is enabled on the device
+    };
+
+    export struct Allocation {
+        DeviceMemory memory{};
+        DeviceSize offset{0};
+        DeviceSize size{0};
+        uint32_t memory_type{0};
+        MemoryPropertyFlags properties{};
+        std::byte* mapped{nullptr}; // non-null for host-visible memory, already offset to this allocation
+
+        std::shared_ptr<AllocatorState> owner{};
+        uint32_t block{0};
+        uint32_t tag{0}; // see register_tag(); 0 is "untagged"
+
+        Allocation() = default;
+        ~Allocation();
+        Allocation(Allocation&& other) noexcept;
+        Allocation& operator=(Allocation&& other) noexcept;
+        Allocation(const Allocation&)            = delete;
+        Allocation& operator=(const Allocation&) = delete;
+    };
+
+    export struct Allocator {
+        std::shared_ptr<AllocatorState> state{};
+    };
+
+    export struct MemoryTypeStats {
+        uint32_t memory_type{0};
+        uint32_t heap{0};
+        uint32_t block_count{0};
+        uint32_t dedicated_count{0};
+        uint32_t allocation_count{0};
+        DeviceSize reserved_bytes{0};
+        DeviceSize used_bytes{0};
+        DeviceSize free_bytes{0};
+        DeviceSize largest_free_range{0};
+        uint32_t free_range_count{0};
+        float fragmentation{0.0f}; // 1 - largest_free_range / free_bytes
+    };
+
+    export struct AllocatorStats {
+        std::vector<MemoryTypeStats> types;
+        uint32_t block_count{0};
+        uint32_t allocation_count{0};
+        DeviceSize reserved_bytes{0};
+        DeviceSize used_bytes{0};
+        float fragmentation{0.0f};
+    };
+
+    export struct HeapBudget {
+        uint32_t heap{0};
+        bool device_local{false};
+        DeviceSize size{0};
+        DeviceSize budget{0}; // from VK_EXT_memory_budget, otherwise the heap size
+        DeviceSize usage{0}; // process-wide usage reported by the driver, otherwise reserved_bytes
+        DeviceSize reserved_bytes{0}; // device memory held by this allocator
+        DeviceSize used_bytes{0};
+        uint32_t allocation_count{0};
+    };
+
+    export struct TagStats {
+        std::string name;
+        uint32_t allocation_count{0};
+        DeviceSize bytes{0};
+    };
+
+    // Driver CPU allocations made through host_allocation_callbacks().
+    export struct HostAllocationStats {
+        std::uint64_t live_allocations{0};
+        std::uint64_t live_bytes{0};
+        std::uint64_t peak_bytes{0};
+        std::uint64_t total_allocations{0};
+        std::uint64_t internal_bytes{0}; // reported through pfnInternalAllocation
+    };
+
+    export struct MemoryTelemetry {
+        std::vector<HeapBudget> heaps;
+        std::vector<TagStats> tags;
+        AllocatorStats allocator{};
+        HostAllocationStats host{};
+        bool budget_available{false};
+        float max_heap_pressure{0.0f}; // max over heaps of usage / budget
+    };
+
     export struct Buffer {
+        Allocation allocation{};
         raii::Buffer buffer{nullptr};
-        raii::DeviceMemory memory{nullptr};
         DeviceSize size{0};
     };
 
-    export struct MeshGPU {
-        Buffer vertex_buffer;
-        Buffer index_buffer;
+    export enum class HostAccess : std::uint8_t {
+        SequentialWrite, // CPU writes, GPU reads: prefers coherent memory
+        Readback, // GPU writes, CPU reads: prefers cached memory
+    };
+
+    // Host-visible buffer that stays mapped for its whole lifetime. On non-coherent
+    // memory, writes are recorded as dirty ranges and made visible by flush_mapped().
+    export struct MappedBuffer {
+        Buffer buffer{};
+        std::byte* mapped{nullptr};
+        bool coherent{true};
+        DeviceSize atom{1};
+        std::vector<std::pair<DeviceSize, DeviceSize>> dirty{}; // [begin, end) relative to the buffer
+    };
+
+    // Persistently mapped upload buffer used as a ring. Regions are bump-allocated
+    // from `head`, grouped into batches by close_batch(), and recycled once the
+    // batch's value has been signaled on `timeline`.
+    export struct StagingRing {
+        struct Batch {
+            DeviceSize end{0};
+            DeviceSize bytes{0};
+            uint64_t value{0};
+        };
+
+        Buffer buffer{};
+        raii::Semaphore timeline{nullptr};
+        DeviceSize capacity{0};
+        DeviceSize head{0};
+        DeviceSize tail{0};
+        DeviceSize used{0};
+        DeviceSize open_bytes{0};
+        uint64_t submitted{0};
+        std::deque<Batch> in_flight{};
+    };
+
+    export struct StagingSlice {
+        vk::Buffer buffer{};
+        DeviceSize offset{0};
+        DeviceSize size{0};
+        std::byte* mapped{nullptr};
+    };
+
+    // A point on a timeline semaphore; complete once the semaphore reaches `value`.
+    export struct TransferTicket {
+        Semaphore semaphore{};
+        uint64_t value{0};
+    };
+
+    // Records buffer and image copies from many callers into one command buffer and
+    // submits them together on flush(). Submissions signal the staging ring's
+    // timeline, so a ticket both retires staging space and tells callers when the
+    // destination resources are ready.
+    //
+    // A batcher on a dedicated transfer family hands uploaded buffers over to
+    // `dst_queue_family`: flush() records the release barriers and record_acquires()
+    // records the matching acquires on the consuming queue. A ring's timeline may only
+    // be signaled from one queue, so such a batcher needs its own StagingRing.
+    export struct TransferBatcher {
+        struct Pending {
+            raii::CommandBuffer cmd{nullptr};
+            uint64_t value{0};
+        };
+
+        raii::CommandPool command_pool{nullptr};
+        raii::CommandBuffer recording{nullptr};
+        bool recording_open{false};
+        uint32_t queue_family{0};
+        uint32_t dst_queue_family{0};
+        uint32_t recorded_ops{0};
+        std::deque<Pending> in_flight{};
+        std::vector<raii::CommandBuffer> free_cmds{};
+
+        std::vector<BufferMemoryBarrier2> releases{}; // recorded at the end of the open batch
+        std::vector<BufferMemoryBarrier2> acquires{}; // released by a submitted batch, awaiting record_acquires()
+        TransferTicket acquire_ticket{};
+    };
+
+    // Byte offsets of one mesh inside a packed vertex+index buffer.
+    export struct MeshRange {
+        DeviceSize vertex_offset{0};
+        DeviceSize index_offset{0};
+        uint32_t vertex_count{0};
         uint32_t index_count{0};
     };
 
+    export struct MeshGPU {
+        Buffer buffer; // vertices followed by uint32 indices
+        MeshRange range{};
+    };
+
+    // Many meshes sharing one device-local buffer, uploaded in a single submission.
+    export struct MeshBatchGPU {
+        Buffer buffer;
+        std::vector<MeshRange> meshes;
+    };
+
     export template <typename VertexT>
     struct MeshCPU {
         std::vector<VertexT> vertices;
@@ -23,27 +213,147 @@ namespace vk::memory {
     };
 
     export [[nodiscard]] uint32_t find_memory_type(const raii::PhysicalDevice& physical_device, uint32_t type_bits, MemoryPropertyFlags required);
-    export [[nodiscard]] Buffer create_buffer(const raii::PhysicalDevice& physical_device, const raii::Device& device, DeviceSize size, BufferUsageFlags usage, MemoryPropertyFlags mem_props);
+
+    export [[nodiscard]] Allocator create_allocator(const raii::PhysicalDevice& physical_device, const AllocatorDesc& desc = {});
+    export [[nodiscard]] Allocation allocate(const Allocator& allocator, const raii::Device& device, const MemoryRequirements& requirements, MemoryPropertyFlags required, ResourceKind kind, MemoryPropertyFlags preferred = {});
+    export [[nodiscard]] Allocation allocate_for_buffer(const Allocator& allocator, const raii::Device& device, const raii::Buffer& buffer, MemoryPropertyFlags required, MemoryPropertyFlags preferred = {});
+    export [[nodiscard]] Allocation allocate_for_image(const Allocator& allocator, const raii::Device& device, const raii::Image& image, MemoryPropertyFlags required, MemoryPropertyFlags preferred = {});
+    export void release(Allocation& allocation) noexcept;
+    export [[nodiscard]] AllocatorStats query_stats(const Allocator& allocator);
+
+    export [[nodiscard]] uint32_t register_tag(const Allocator& allocator, std::string_view name);
+    export void set_tag(Allocation& allocation, uint32_t tag);
+    export [[nodiscard]] MemoryTelemetry query_telemetry(const Allocator& allocator, const raii::PhysicalDevice& physical_device);
+    export [[nodiscard]] const AllocationCallbacks* host_allocation_callbacks();
+    export [[nodiscard]] HostAllocationStats query_host_allocations();
+
+    export [[nodiscard]] StagingRing create_staging_ring(const Allocator& allocator, const raii::Device& device, DeviceSize capacity);
+    export void recycle(StagingRing& ring);
+    export [[nodiscard]] std::optional<StagingSlice> try_stage(StagingRing& ring, std::span<const std::byte> bytes, DeviceSize alignment = 16);
+    export [[nodiscard]] StagingSlice stage(StagingRing& ring, const raii::Device& device, std::span<const std::byte> bytes, DeviceSize alignment = 16);
+    export [[nodiscard]] uint64_t close_batch(StagingRing& ring);
+    export [[nodiscard]] uint64_t submit_staged(StagingRing& ring, const raii::Queue& queue, const raii::CommandBuffer& cmd);
+    export void wait_staged(const StagingRing& ring, const raii::Device& device, uint64_t value);
+
+    export [[nodiscard]] TransferBatcher create_transfer_batcher(const raii::Device& device, uint32_t queue_family, uint32_t dst_queue_family = VK_QUEUE_FAMILY_IGNORED);
+    export [[nodiscard]] const raii::CommandBuffer& batch_cmd(TransferBatcher& batcher, const raii::Device& device);
+    export [[nodiscard]] StagingSlice stage_for_batch(TransferBatcher& batcher, StagingRing& ring, const raii::Device& device, const raii::Queue& queue, std::span<const std::byte> bytes, DeviceSize alignment = 16);
+    export void enqueue_buffer_upload(TransferBatcher& batcher, StagingRing& ring, const raii::Device& device, const raii::Queue& queue, std::span<const std::byte> bytes, const Buffer& dst, DeviceSize dst_offset = 0);
+    export void enqueue_buffer_copy(TransferBatcher& batcher, const raii::Device& device, const Buffer& src, const Buffer& dst, std::span<const BufferCopy> regions);
+    export [[nodiscard]] TransferTicket flush(TransferBatcher& batcher, StagingRing& ring, const raii::Queue& queue);
+    export [[nodiscard]] TransferTicket record_acquires(TransferBatcher& batcher, const raii::CommandBuffer& cmd, PipelineStageFlags2 dst_stage = PipelineStageFlagBits2::eAllCommands, AccessFlags2 dst_access = AccessFlagBits2::eMemoryRead);
+    export [[nodiscard]] bool is_complete(const raii::Device& device, const TransferTicket& ticket);
+    export void wait_ticket(const raii::Device& device, const TransferTicket& ticket);
+    export [[nodiscard]] SemaphoreSubmitInfo wait_info(const TransferTicket& ticket, PipelineStageFlags2 stages = PipelineStageFlagBits2::eAllCommands);
+
+    export [[nodiscard]] Buffer create_buffer(const Allocator& allocator, const raii::Device& device, DeviceSize size, BufferUsageFlags usage, MemoryPropertyFlags mem_props);
     export void write_mapped(const Buffer& dst, std::span<const std::byte> bytes);
+
+    export [[nodiscard]] MappedBuffer create_mapped_buffer(const Allocator& allocator, const raii::Device& device, DeviceSize size, BufferUsageFlags usage, HostAccess access = HostAccess::SequentialWrite);
+    export void mark_dirty(MappedBuffer& dst, DeviceSize offset, DeviceSize size);
+    export void write(MappedBuffer& dst, DeviceSize offset, std::span<const std::byte> bytes);
+    export void flush_mapped(const raii::Device& device, MappedBuffer& dst);
+    export void flush_mapped(const raii::Device& device, std::span<MappedBuffer* const> buffers);
+    export void invalidate_mapped(const raii::Device& device, const MappedBuffer& src, DeviceSize offset = 0, DeviceSize size = WholeSize);
+    export template <typename T>
+    [[nodiscard]] std::span<T> write_view(MappedBuffer& dst, DeviceSize offset, std::size_t count);
+    export template <typename T>
+    [[nodiscard]] std::span<const T> read_view(const MappedBuffer& src, DeviceSize offset, std::size_t count);
     export void copy_buffer_immediate(const raii::Device& device, const raii::CommandPool& command_pool, const raii::Queue& queue, const Buffer& src, const Buffer& dst, DeviceSize size);
-    export [[nodiscard]] Buffer upload_to_device_local_buffer(const raii::PhysicalDevice& physical_device, const raii::Device& device, const raii::CommandPool& command_pool, const raii::Queue& queue, std::span<const std::byte> bytes, BufferUsageFlags final_usage);
+    export [[nodiscard]] Buffer enqueue_upload_to_device_local_buffer(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, std::span<const std::byte> bytes, BufferUsageFlags final_usage);
+    export [[nodiscard]] Buffer upload_to_device_local_buffer(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, std::span<const std::byte> bytes, BufferUsageFlags final_usage);
+    export void bind_mesh(const raii::CommandBuffer& cmd, const Buffer& buffer, const MeshRange& range);
+    export template <typename VertexT>
+    [[nodiscard]] MeshBatchGPU enqueue_upload_meshes(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, std::span<const MeshCPU<VertexT>> meshes);
     export template <typename VertexT>
-    [[nodiscard]] MeshGPU upload_mesh(const raii::PhysicalDevice& physical_device, const raii::Device& device, const raii::CommandPool& command_pool, const raii::Queue& queue, const MeshCPU<VertexT>& mesh);
+    [[nodiscard]] MeshBatchGPU upload_meshes(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, std::span<const MeshCPU<VertexT>> meshes);
+    export template <typename VertexT>
+    [[nodiscard]] MeshGPU enqueue_upload_mesh(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, const MeshCPU<VertexT>& mesh);
+    export template <typename VertexT>
+    [[nodiscard]] MeshGPU upload_mesh(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, const MeshCPU<VertexT>& mesh);
 } // namespace vk::memory
 
+template <typename T>
+std::span<T> vk::memory::write_view(MappedBuffer& dst, const DeviceSize offset, const std::size_t count) {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    const DeviceSize bytes = static_cast<DeviceSize>(count) * sizeof(T);
+    if (offset + bytes > dst.buffer.size) throw std::runtime_error("vk.memory: write_view out of range");
+    if (offset % alignof(T) != 0) throw std::runtime_error("vk.memory: write_view misaligned");
+
+    mark_dirty(dst, offset, bytes);
+    return {reinterpret_cast<T*>(dst.mapped + offset), count};
+}
+
+template <typename T>
+std::span<const T> vk::memory::read_view(const MappedBuffer& src, const DeviceSize offset, const std::size_t count) {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    const DeviceSize bytes = static_cast<DeviceSize>(count) * sizeof(T);
+    if (offset + bytes > src.buffer.size) throw std::runtime_error("vk.memory: read_view out of range");
+    if (offset % alignof(T) != 0) throw std::runtime_error("vk.memory: read_view misaligned");
+
+    return {reinterpret_cast<const T*>(src.mapped + offset), count};
+}
+
 template <typename VertexT>
-vk::memory::MeshGPU vk::memory::upload_mesh(const raii::PhysicalDevice& physical_device, const raii::Device& device, const raii::CommandPool& command_pool, const raii::Queue& queue, const MeshCPU<VertexT>& mesh) {
+vk::memory::MeshBatchGPU vk::memory::enqueue_upload_meshes(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, std::span<const MeshCPU<VertexT>> meshes) {
     static_assert(std::is_standard_layout_v<VertexT>);
     static_assert(std::is_trivially_copyable_v<VertexT>);
 
-    if (mesh.vertices.empty() || mesh.indices.empty()) throw std::runtime_error("MeshCPU is empty");
+    if (meshes.empty()) throw std::runtime_error("vk.memory: no meshes to upload");
 
-    const std::span<const std::byte> vertex_bytes{reinterpret_cast<const std::byte*>(mesh.vertices.data()), mesh.vertices.size() * sizeof(VertexT)};
-    const std::span<const std::byte> index_bytes{reinterpret_cast<const std::byte*>(mesh.indices.data()), mesh.indices.size() * sizeof(uint32_t)};
+    // Index offsets must be a multiple of the index size; 16 also keeps vertex data vec4 aligned.
+    constexpr DeviceSize alignment = 16;
+    const auto align               = [](const DeviceSize v) { return (v + alignment - 1) / alignment * alignment; };
+
+    MeshBatchGPU out{};
+    out.meshes.reserve(meshes.size());
+
+    DeviceSize cursor = 0;
+    for (const auto& mesh : meshes) {
+        if (mesh.vertices.empty() || mesh.indices.empty()) throw std::runtime_error("MeshCPU is empty");
+
+        MeshRange r{};
+        r.vertex_offset = align(cursor);
+        r.vertex_count  = static_cast<uint32_t>(mesh.vertices.size());
+        r.index_offset  = align(r.vertex_offset + mesh.vertices.size() * sizeof(VertexT));
+        r.index_count   = static_cast<uint32_t>(mesh.indices.size());
+        cursor          = r.index_offset + mesh.indices.size() * sizeof(uint32_t);
+        out.meshes.push_back(r);
+    }
+
+    // Each mesh is staged straight from its own arrays; the copies all land in the same batch.
+    out.buffer = create_buffer(allocator, device, cursor, BufferUsageFlagBits::eVertexBuffer | BufferUsageFlagBits::eIndexBuffer | BufferUsageFlagBits::eTransferDst, MemoryPropertyFlagBits::eDeviceLocal);
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        const auto& mesh = meshes[i];
+        const auto& r    = out.meshes[i];
+        enqueue_buffer_upload(batcher, staging, device, queue, std::as_bytes(std::span{mesh.vertices}), out.buffer, r.vertex_offset);
+        enqueue_buffer_upload(batcher, staging, device, queue, std::as_bytes(std::span{mesh.indices}), out.buffer, r.index_offset);
+    }
+    set_tag(out.buffer.allocation, register_tag(allocator, "mesh"));
+    return out;
+}
 
-    MeshGPU gpu{};
-    gpu.vertex_buffer = upload_to_device_local_buffer(physical_device, device, command_pool, queue, vertex_bytes, BufferUsageFlagBits::eVertexBuffer);
-    gpu.index_buffer  = upload_to_device_local_buffer(physical_device, device, command_pool, queue, index_bytes, BufferUsageFlagBits::eIndexBuffer);
-    gpu.index_count   = static_cast<uint32_t>(mesh.indices.size());
+template <typename VertexT>
+vk::memory::MeshBatchGPU vk::memory::upload_meshes(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, std::span<const MeshCPU<VertexT>> meshes) {
+    MeshBatchGPU gpu = enqueue_upload_meshes(allocator, device, queue, staging, batcher, meshes);
+    wait_ticket(device, flush(batcher, staging, queue));
+    return gpu;
+}
+
+template <typename VertexT>
+vk::memory::MeshGPU vk::memory::enqueue_upload_mesh(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, const MeshCPU<VertexT>& mesh) {
+    MeshBatchGPU batch = enqueue_upload_meshes(allocator, device, queue, staging, batcher, std::span{&mesh, 1});
+    return MeshGPU{
+        .buffer = std::move(batch.buffer),
+        .range  = batch.meshes.front(),
+    };
+}
+
+template <typename VertexT>
+vk::memory::MeshGPU vk::memory::upload_mesh(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, const MeshCPU<VertexT>& mesh) {
+    MeshGPU gpu = enqueue_upload_mesh(allocator, device, queue, staging, batcher, mesh);
+    wait_ticket(device, flush(batcher, staging, queue));
     return gpu;
 }
@@ -24,23 +24,304 @@ namespace vk::pipeline {
         FrontFace front_face{FrontFace::eCounterClockwise};
         PolygonMode polygon_mode{PolygonMode::eFill};
 
+        // Opt-in dynamic state, set per draw with set_raster_state() after binding the pipeline.
+        // dynamic_raster_state covers cull mode, front face, topology and depth test/write/compare
+        // (core in Vulkan 1.3); the topology may only change within its class (points, lines,
+        // triangles, patches). dynamic_polygon_mode needs context::VulkanContext::dynamic_polygon_mode;
+        // the registry rejects it unless PipelineRegistry::dynamic_polygon_mode is set.
+        // Pipelines that differ only in dynamic state share one registry entry.
+        bool dynamic_raster_state{false};
+        bool dynamic_polygon_mode{false};
+
         std::uint32_t push_constant_bytes{0};
         ShaderStageFlags push_constant_stages{ShaderStageFlagBits::eVertex | ShaderStageFlagBits::eFragment};
 
         std::span<const DescriptorSetLayout> set_layouts{};
     };
 
+    export struct RasterState {
+        PrimitiveTopology topology{PrimitiveTopology::eTriangleList};
+        CullModeFlags cull{CullModeFlagBits::eBack};
+        FrontFace front_face{FrontFace::eCounterClockwise};
+        PolygonMode polygon_mode{PolygonMode::eFill};
+        bool depth_test{true};
+        bool depth_write{true};
+        CompareOp depth_compare{CompareOp::eLessOrEqual};
+    };
+
+    export struct PipelineCacheStats {
+        bool warm{false}; // a valid cache file was loaded at startup
+        std::size_t loaded_bytes{0};
+        std::size_t saved_bytes{0};
+        std::uint64_t saved_hash{0}; // of the payload last loaded or saved; unchanged data is not rewritten
+        double load_ms{0.0};
+
+        // From VkPipelineCreationFeedback for pipelines created through this cache.
+        std::uint32_t pipelines{0};
+        std::uint32_t hits{0};
+        std::uint32_t misses{0};
+        double create_ms{0.0};
+    };
+
+    // A VkPipelineCache persisted to disk. The file carries its own header (vendor and device
+    // ID, driver version, cache UUID, payload size and hash); any mismatch starts a cold cache.
+    export struct PipelineCache {
+        raii::PipelineCache cache{nullptr};
+        std::filesystem::path path{};
+
+        std::uint32_t vendor_id{0};
+        std::uint32_t device_id{0};
+        std::uint32_t driver_version{0};
+        std::array<std::uint8_t, UuidSize> uuid{};
+
+        PipelineCacheStats stats{};
+    };
+
     export struct VertexInput {
         VertexInputBindingDescription binding{};
         std::vector<VertexInputAttributeDescription> attributes{};
     };
 
+    export struct ReflectedBinding {
+        std::uint32_t set{0};
+        std::uint32_t binding{0};
+        DescriptorType type{DescriptorType::eUniformBuffer};
+        std::uint32_t count{1}; // 0: runtime-sized array
+        std::string name{};
+    };
+
+    export struct ReflectedPushBlock {
+        std::uint32_t offset{0};
+        std::uint32_t size{0}; // rounded up to 4 bytes
+        std::string name{};
+    };
+
+    export struct ReflectedVertexInput {
+        std::uint32_t location{0};
+        Format format{Format::eUndefined}; // eUndefined for types without a vertex format
+        std::string name{};
+    };
+
+    export struct ReflectedSpecConstant {
+        std::uint32_t id{0};
+        std::uint32_t size{0}; // booleans are 4 bytes, as in VkSpecializationMapEntry
+        std::uint64_t default_value{0};
+        std::string name{};
+    };
+
+    export struct ReflectedEntryPoint {
+        std::string name{};
+        ShaderStageFlagBits stage{ShaderStageFlagBits::eVertex};
+        std::vector<std::uint32_t> bindings{}; // indices into ShaderReflection::bindings
+        std::vector<std::uint32_t> push_blocks{}; // indices into ShaderReflection::push_blocks
+        std::vector<ReflectedVertexInput> inputs{}; // vertex entry points only
+    };
+
+    // Interface of a SPIR-V module. From SPIR-V 1.4 on, entry points list every global they use,
+    // so resources are attributed per entry point; older modules attribute all of them to every
+    // entry point.
+    export struct ShaderReflection {
+        std::uint32_t spirv_version{0};
+        std::vector<ReflectedEntryPoint> entry_points{};
+        std::vector<ReflectedBinding> bindings{};
+        std::vector<ReflectedPushBlock> push_blocks{};
+        std::vector<ReflectedSpecConstant> spec_constants{};
+    };
+
+    export struct ShaderHandle {
+        std::shared_ptr<const raii::ShaderModule> module{};
+        std::shared_ptr<const ShaderReflection> reflection{};
+        std::uint64_t hash{0}; // of the SPIR-V words
+    };
+
+    // Set and pipeline layout inputs derived from a shader's reflection. apply_layout() points a
+    // GraphicsPipelineDesc at them; the set layouts are owned by the registry and shared by every
+    // shader with the same bindings.
+    export struct ReflectedLayout {
+        std::vector<std::shared_ptr<const raii::DescriptorSetLayout>> sets{}; // index = set number
+        std::vector<DescriptorSetLayout> handles{};
+        std::vector<std::vector<DescriptorSetLayoutBinding>> bindings{}; // per set, sorted by binding
+        std::uint32_t push_constant_bytes{0};
+        ShaderStageFlags push_constant_stages{};
+    };
+
+    export struct SharedPipeline {
+        std::shared_ptr<const raii::PipelineLayout> layout{};
+        std::shared_ptr<const raii::Pipeline> pipeline{};
+    };
+
+    // Registry keys hold the full description; lookups hash them but always compare every field,
+    // so a hash collision can never return an object built from different state.
+    export struct ShaderKey {
+        std::vector<std::byte> spv{};
+        bool operator==(const ShaderKey&) const = default;
+    };
+
+    export struct SetLayoutKey {
+        std::vector<DescriptorSetLayoutBinding> bindings{}; // sorted by binding
+        bool operator==(const SetLayoutKey&) const = default;
+    };
+
+    // Set layouts are identified by their bindings rather than their handles, so a destroyed
+    // layout whose handle value is reused cannot match a stale entry.
+    export struct LayoutKey {
+        std::vector<SetLayoutKey> sets{};
+        std::uint32_t push_constant_bytes{0};
+        ShaderStageFlags push_constant_stages{};
+        bool operator==(const LayoutKey&) const = default;
+    };
+
+    // State made dynamic by the desc is left at its default, so its permutations share a key.
+    export struct PipelineKey {
+        LayoutKey layout{};
+        std::shared_ptr<const raii::ShaderModule> shader{}; // registry-owned, one per SPIR-V content
+        std::string vs_entry{};
+        std::string fs_entry{};
+        VertexInputBindingDescription binding{};
+        std::vector<VertexInputAttributeDescription> attributes{};
+        Format color_format{};
+        Format depth_format{};
+        bool use_depth{false};
+        bool use_blend{false};
+        bool dynamic_raster_state{false};
+        bool dynamic_polygon_mode{false};
+        std::uint32_t topology{0}; // the topology class when dynamic
+        CullModeFlags cull{};
+        FrontFace front_face{};
+        PolygonMode polygon_mode{};
+        bool operator==(const PipelineKey&) const = default;
+    };
+
+    export struct KeyHash {
+        [[nodiscard]] std::size_t operator()(const ShaderKey& key) const;
+        [[nodiscard]] std::size_t operator()(const SetLayoutKey& key) const;
+        [[nodiscard]] std::size_t operator()(const LayoutKey& key) const;
+        [[nodiscard]] std::size_t operator()(const PipelineKey& key) const;
+    };
+
+    export struct PipelineRegistryStats {
+        std::uint32_t shader_hits{0};
+        std::uint32_t shader_misses{0};
+        std::uint32_t set_layout_hits{0};
+        std::uint32_t set_layout_misses{0};
+        std::uint32_t layout_hits{0};
+        std::uint32_t layout_misses{0};
+        std::uint32_t pipeline_hits{0};
+        std::uint32_t pipeline_misses{0};
+    };
+
+    // Deduplicates shader modules by SPIR-V content, descriptor set layouts by their bindings,
+    // pipeline layouts by set layouts and push-constant range, and pipelines by the full
+    // description (layout, vertex input, fixed function state, formats, shader and entry
+    // points). Pipelines that differ only in their shaders share one layout. Set layouts in a
+    // desc passed to the registry must come from acquire_set_layout or acquire_reflected_layout.
+    // Entries live until trim() finds them unused. Thread-safe.
+    export struct PipelineRegistry {
+        PipelineCache* cache{nullptr}; // optional, used for every pipeline created here
+        bool dynamic_polygon_mode{false}; // copy of context::VulkanContext::dynamic_polygon_mode
+
+        std::mutex mutex{};
+        std::unordered_map<ShaderKey, ShaderHandle, KeyHash> shaders{};
+        std::unordered_map<SetLayoutKey, std::shared_ptr<const raii::DescriptorSetLayout>, KeyHash> set_layouts{};
+        std::unordered_map<DescriptorSetLayout, SetLayoutKey> set_layout_keys{}; // handle -> key in set_layouts
+        std::unordered_map<LayoutKey, std::shared_ptr<const raii::PipelineLayout>, KeyHash> layouts{};
+        std::unordered_map<PipelineKey, SharedPipeline, KeyHash> pipelines{};
+        PipelineRegistryStats stats{};
+    };
+
+    // One pipeline for PipelineCompiler. The job owns copies of everything it refers to;
+    // desc.set_layouts is copied on submission, so the caller's span need not outlive it.
+    export struct PipelineJob {
+        VertexInput vin{};
+        GraphicsPipelineDesc desc{};
+        ShaderHandle shader{}; // from acquire_shader
+        std::string vs_entry{};
+        std::string fs_entry{};
+    };
+
+    export struct PipelineFuture {
+        std::shared_future<SharedPipeline> future{};
+    };
+
+    export struct CompilerStats {
+        std::uint32_t submitted{0};
+        std::uint32_t deduplicated{0}; // already in the registry or already queued
+        std::uint32_t completed{0};
+        std::uint32_t failed{0};
+        std::uint32_t batches{0}; // createGraphicsPipelines calls
+        double compile_ms{0.0}; // summed wall time of those calls across workers
+    };
+
+    // Compiles pipelines on a pool of worker threads. Each worker takes a share of the queue
+    // (at most max_batch jobs) and creates it with one createGraphicsPipelines call, so drivers
+    // that parallelise internally still see batches, and finished pipelines land in the
+    // registry where acquire_pipeline() finds them. Destroying the compiler drops queued jobs
+    // (their futures report broken_promise) and joins the workers after their current batch.
+    export struct PipelineCompiler {
+        struct Job {
+            PipelineKey key{};
+            PipelineJob request{};
+            std::vector<DescriptorSetLayout> set_layouts{};
+            std::promise<SharedPipeline> promise{};
+        };
+
+        const raii::Device* device{nullptr};
+        PipelineRegistry* registry{nullptr};
+        std::uint32_t max_batch{8};
+
+        std::mutex mutex{};
+        std::condition_variable_any wake{};
+        std::condition_variable idle{};
+        std::deque<Job> queue{};
+        std::unordered_map<PipelineKey, std::shared_future<SharedPipeline>, KeyHash> in_flight{};
+        std::uint32_t active{0}; // jobs taken by workers and not yet finished
+        CompilerStats stats{};
+
+        std::vector<std::jthread> workers{}; // last: joined before the state above is destroyed
+    };
+
     export template <typename VertexT>
     [[nodiscard]] VertexInput make_vertex_input();
 
     export [[nodiscard]] std::vector<std::byte> read_file_bytes(const std::string& path);
     export [[nodiscard]] raii::ShaderModule load_shader_module(const raii::Device& device, std::span<const std::byte> spv);
-    export [[nodiscard]] GraphicsPipeline create_graphics_pipeline(const raii::Device& device, const VertexInput& vin, const GraphicsPipelineDesc& desc, const raii::ShaderModule& shader_module, const char* vs_entry, const char* fs_entry);
+    // Throws on malformed SPIR-V; unknown instructions are skipped.
+    export [[nodiscard]] ShaderReflection reflect_shader(std::span<const std::byte> spv);
+    export [[nodiscard]] GraphicsPipeline create_graphics_pipeline(const raii::Device& device, const VertexInput& vin, const GraphicsPipelineDesc& desc, const raii::ShaderModule& shader_module, const char* vs_entry, const char* fs_entry, PipelineCache* cache = nullptr);
+
+    // Records the parts of `state` that `desc` made dynamic; the rest is ignored.
+    export void set_raster_state(const raii::CommandBuffer& cmd, const GraphicsPipelineDesc& desc, const RasterState& state);
+
+    // Also reflects the module, so layout mismatches surface when the shader is loaded.
+    export [[nodiscard]] ShaderHandle acquire_shader(PipelineRegistry& registry, const raii::Device& device, std::span<const std::byte> spv);
+    export [[nodiscard]] std::shared_ptr<const raii::DescriptorSetLayout> acquire_set_layout(PipelineRegistry& registry, const raii::Device& device, std::span<const DescriptorSetLayoutBinding> bindings);
+    export [[nodiscard]] std::shared_ptr<const raii::PipelineLayout> acquire_layout(PipelineRegistry& registry, const raii::Device& device, const GraphicsPipelineDesc& desc);
+    // Merges the bindings and push constants of both entry points; throws when they declare one
+    // binding with different types or counts, or use a runtime-sized array.
+    export [[nodiscard]] ReflectedLayout acquire_reflected_layout(PipelineRegistry& registry, const raii::Device& device, const ShaderHandle& shader, const char* vs_entry, const char* fs_entry);
+    // Fills desc.set_layouts (pointing into `layout`) and the push-constant range.
+    export void apply_layout(const ReflectedLayout& layout, GraphicsPipelineDesc& desc);
+    // Throws when the pipeline disagrees with the shader: missing entry points, vertex inputs
+    // without an attribute of the same numeric type, sets beyond desc.set_layouts, or push
+    // constants outside the desc's range. acquire_pipeline and compile_async run it for every
+    // reflected shader.
+    export void validate_pipeline(const ShaderReflection& reflection, const VertexInput& vin, const GraphicsPipelineDesc& desc, const char* vs_entry, const char* fs_entry);
+    export [[nodiscard]] SharedPipeline acquire_pipeline(PipelineRegistry& registry, const raii::Device& device, const VertexInput& vin, const GraphicsPipelineDesc& desc, const ShaderHandle& shader, const char* vs_entry, const char* fs_entry);
+    export std::size_t trim(PipelineRegistry& registry); // drops entries nobody else holds; returns the count
+
+    // threads = 0 uses one fewer than the hardware concurrency (at least one). The registry and
+    // device must outlive the compiler.
+    export [[nodiscard]] std::unique_ptr<PipelineCompiler> create_pipeline_compiler(const raii::Device& device, PipelineRegistry& registry, std::uint32_t threads = 0, std::uint32_t max_batch = 8);
+    export [[nodiscard]] PipelineFuture compile_async(PipelineCompiler& compiler, PipelineJob job);
+    export void wait_idle(PipelineCompiler& compiler);
+    export [[nodiscard]] bool ready(const PipelineFuture& future);
+    // Never blocks: the compiled pipeline once ready, otherwise `fallback`. Rethrows compile errors.
+    export [[nodiscard]] Pipeline pipeline_or(const PipelineFuture& future, Pipeline fallback);
+
+    export [[nodiscard]] PipelineCache open_pipeline_cache(const raii::PhysicalDevice& physical_device, const raii::Device& device, std::filesystem::path path);
+    // Writes to a temporary file and renames it over `path`; skipped when the data is unchanged
+    // since the last load or save, so it is cheap enough to call periodically.
+    export void save_pipeline_cache(PipelineCache& cache);
 } // namespace vk::pipeline
 
 namespace vk::pipeline::detail {
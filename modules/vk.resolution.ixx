@@ -0,0 +1,90 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module vk.resolution;
+
+import vk.context;
+import vk.frame;
+import vk.memory;
+import vk.swapchain;
+import std;
+
+namespace vk::resolution {
+
+    // Dynamic resolution: the scene renders into the top-left `extent` of color/depth targets
+    // allocated at the swapchain size, so changing the scale never reallocates. record_upscale()
+    // blits that region to the swapchain image, after which the UI draws at native resolution.
+    // Shaders sampling the target should scale UVs by uv_scale().
+
+    // Proportional-integral controller on the relative GPU-time error. GPU time is taken as
+    // proportional to pixel count, so the correction is applied to scale^2 (the area).
+    export struct ScaleController {
+        float target_ms{14.0f}; // leave headroom below the refresh interval
+        float min_scale{0.5f};
+        float max_scale{1.0f};
+        float kp{0.5f};
+        float ki{0.05f};
+        float deadband{0.05f}; // relative errors below this leave the scale unchanged
+        float smoothing{0.3f}; // weight of the newest sample in filtered_ms
+        uint32_t settle_frames{3}; // frames to wait after a change; covers the timestamp readback latency
+
+        // Controller state, exposed for tuning overlays.
+        float scale{1.0f};
+        float filtered_ms{0.0f};
+        float error{0.0f};
+        float integral{0.0f};
+        uint32_t cooldown{0};
+    };
+
+    export struct ScaledTargetDesc {
+        Format color_format{Format::eUndefined}; // eUndefined: the swapchain format
+        uint32_t granularity{8}; // render extents are rounded to multiples of this
+        ScaleController controller{};
+    };
+
+    export struct ScaledTarget {
+        Extent2D max_extent{};
+        Extent2D extent{}; // current render extent, <= max_extent
+        uint32_t granularity{8};
+        ScaleController controller{};
+
+        Format color_format{};
+        memory::Allocation color_allocation{};
+        raii::Image color_image{nullptr};
+        raii::ImageView color_view{nullptr};
+        ImageLayout color_layout{ImageLayout::eUndefined};
+
+        Format depth_format{};
+        ImageAspectFlags depth_aspect{};
+        memory::Allocation depth_allocation{};
+        raii::Image depth_image{nullptr};
+        raii::ImageView depth_view{nullptr};
+        ImageLayout depth_layout{ImageLayout::eUndefined};
+
+        ScaledTarget()                                   = default;
+        ~ScaledTarget()                                  = default;
+        ScaledTarget(ScaledTarget&&) noexcept            = default;
+        ScaledTarget& operator=(ScaledTarget&&) noexcept = default;
+        ScaledTarget(const ScaledTarget&)                = delete;
+        ScaledTarget& operator=(const ScaledTarget&)     = delete;
+    };
+
+    export [[nodiscard]] ScaledTarget create_scaled_target(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, const ScaledTargetDesc& desc = {});
+    // Rebuilds the targets at the new swapchain size, keeping the controller state; the old
+    // images are retired through the frame deletion queue.
+    export void on_swapchain_recreated(const context::VulkanContext& vkctx, frame::FrameSystem& frames, const swapchain::Swapchain& sc, ScaledTarget& target);
+
+    // Feeds one GPU-time sample to the controller and updates target.extent. Returns the scale.
+    export float update_scale(ScaledTarget& target, float gpu_ms);
+    // Uses the newest sample of a GPU profiler scope (see frame::profile_begin). Returns false
+    // when the scope was not measured last frame.
+    export bool update_scale(ScaledTarget& target, const frame::FrameSystem& frames, std::string_view scope);
+
+    export [[nodiscard]] Viewport viewport(const ScaledTarget& target);
+    export [[nodiscard]] Rect2D scissor(const ScaledTarget& target);
+    export [[nodiscard]] std::array<float, 2> uv_scale(const ScaledTarget& target);
+
+    // Linear blit of the rendered region to `dst`, leaving `dst` in `final_layout` (color
+    // attachment by default, ready for imgui::render). The texel row and column just past the
+    // region are overwritten with its edge first. Both layout trackers are updated.
+    export void record_upscale(const raii::CommandBuffer& cmd, ScaledTarget& target, Image dst, ImageLayout& dst_layout, Extent2D dst_extent, ImageLayout final_layout = ImageLayout::eColorAttachmentOptimal);
+} // namespace vk::resolution
@@ -2,20 +2,41 @@ module;
 #include <vulkan/vulkan_raii.hpp>
 export module vk.swapchain;
 import vk.context;
+import vk.memory;
 import std;
 
 
 namespace vk::swapchain {
+    // LowLatency: Mailbox, then Immediate (may tear), then FIFO.
+    // TearFree:   Mailbox, then FIFO; never tears, renders uncapped where Mailbox exists.
+    // LowPower:   FIFO with the shortest queue; the CPU and GPU idle between vblanks.
+    export enum class PresentPolicy : std::uint8_t { LowLatency, TearFree, LowPower };
+
+    export struct PresentConfig {
+        PresentPolicy policy{PresentPolicy::LowLatency};
+        uint32_t image_count{0}; // 0: policy default; clamped to the surface limits
+        bool allow_fifo_relaxed{false}; // use FIFO-relaxed when FIFO is chosen: late frames tear instead of waiting a vblank
+    };
+
     export struct Swapchain {
         raii::SwapchainKHR handle{nullptr};
         Format format{};
         ColorSpaceKHR color_space{};
         Extent2D extent{};
+        ImageUsageFlags usage{}; // of the color images
+        PresentConfig present{}; // kept across recreate_swapchain()
+        PresentModeKHR present_mode{PresentModeKHR::eFifo};
+
+        // Offscreen chains own their color targets; `handle` stays null and FrameSystem
+        // skips acquire and present.
+        std::vector<memory::Allocation> offscreen_allocations{};
+        std::vector<raii::Image> offscreen_images{};
+
         std::vector<Image> images{};
         std::vector<raii::ImageView> image_views{};
 
+        memory::Allocation depth_allocation{};
         raii::Image depth_image{nullptr};
-        raii::DeviceMemory depth_memory{nullptr};
         raii::ImageView depth_view{nullptr};
         Format depth_format{};
         ImageAspectFlags depth_aspect{};
@@ -29,6 +50,13 @@ namespace vk::swapchain {
         Swapchain& operator=(const Swapchain&)     = delete;
     };
 
-    export [[nodiscard]] Swapchain setup_swapchain(const context::VulkanContext& vkctx, const context::SurfaceContext& sctx, const Swapchain* old = nullptr);
-    export void recreate_swapchain(const context::VulkanContext& vkctx, context::SurfaceContext& sctx, Swapchain& sc);
+    export [[nodiscard]] Swapchain setup_swapchain(const context::VulkanContext& vkctx, const context::SurfaceContext& sctx, const Swapchain* old = nullptr, const PresentConfig& present = {});
+    // Rebuilds `sc` without draining the device: the old chain is passed as oldSwapchain. The
+    // returned old chain must stay alive until the frames that used it retire (see
+    // frame::recreate_swapchain). With `reuse_depth` the old depth memory is taken over when the
+    // new image fits; pass it only once no submitted work still writes the old depth image.
+    export [[nodiscard]] Swapchain recreate_swapchain(const context::VulkanContext& vkctx, context::SurfaceContext& sctx, Swapchain& sc, bool reuse_depth = false);
+
+    export [[nodiscard]] Swapchain setup_offscreen(const context::VulkanContext& vkctx, Extent2D extent, uint32_t image_count = 3, Format format = Format::eR8G8B8A8Unorm);
+    export [[nodiscard]] bool is_offscreen(const Swapchain& sc);
 } // namespace vk::swapchain
@@ -3,6 +3,7 @@ module;
 export module vk.texture;
 
 import vk.context;
+import vk.memory;
 import std;
 
 namespace vk::texture {
@@ -13,8 +14,8 @@ namespace vk::texture {
         uint32_t mip_levels = 1;
         uint32_t layers     = 1;
 
+        memory::Allocation allocation{};
         raii::Image image{nullptr};
-        raii::DeviceMemory memory{nullptr};
         raii::ImageView view{nullptr};
         raii::Sampler sampler{nullptr};
     };
@@ -25,8 +26,8 @@ namespace vk::texture {
         uint32_t mip_levels = 1;
         uint32_t layers     = 1;
 
+        memory::Allocation allocation{};
         raii::Image image{nullptr};
-        raii::DeviceMemory memory{nullptr};
         raii::ImageView view{nullptr};
         raii::Sampler sampler{nullptr};
     };
@@ -54,7 +55,7 @@ namespace vk::texture {
         float max_anisotropy = 1.0f;
     };
 
-    export [[nodiscard]] Texture2D create_texture_2d_rgba8(const context::VulkanContext& vkctx, std::span<const std::byte> rgba8, Texture2DDesc desc);
-    export [[nodiscard]] Texture2DArray create_texture_2d_array_rgba8(const context::VulkanContext& vkctx, std::span<const std::byte> rgba8, Texture2DDesc desc);
+    export [[nodiscard]] Texture2D create_texture_2d_rgba8(context::VulkanContext& vkctx, std::span<const std::byte> rgba8, Texture2DDesc desc);
+    export [[nodiscard]] Texture2DArray create_texture_2d_array_rgba8(context::VulkanContext& vkctx, std::span<const std::byte> rgba8, Texture2DDesc desc);
     export [[nodiscard]] raii::DescriptorSetLayout make_texture_set_layout(const raii::Device& device);
 } // namespace vk::texture
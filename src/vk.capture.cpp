@@ -0,0 +1,232 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+module vk.capture;
+
+import vk.camera;
+import vk.context;
+import vk.frame;
+import vk.swapchain;
+import std;
+
+namespace vk::capture {
+
+    namespace {
+        struct WriterJob {
+            uint32_t pose_index{0};
+            Extent2D extent{};
+            Format format{};
+            std::vector<std::byte> pixels{};
+        };
+
+        // Bounded queue between the render loop (producer) and the disk thread (consumer).
+        struct SequenceWriter {
+            std::mutex mutex;
+            std::condition_variable_any ready;
+            std::condition_variable space;
+            std::deque<WriterJob> queue;
+            std::size_t max_queued{16};
+            bool closed{false};
+            std::exception_ptr error{};
+            std::uint64_t bytes_written{0}; // owned by the writer thread until it is joined
+        };
+
+        [[nodiscard]] bool is_bgra(const Format format) {
+            switch (format) {
+            case Format::eR8G8B8A8Unorm:
+            case Format::eR8G8B8A8Srgb: return false;
+            case Format::eB8G8R8A8Unorm:
+            case Format::eB8G8R8A8Srgb: return true;
+            default: throw std::runtime_error("vk.capture: image sequences require an 8-bit RGBA/BGRA target");
+            }
+        }
+
+        void write_bytes(std::ofstream& out, const std::span<const std::byte> bytes, const std::filesystem::path& path) {
+            out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+            if (!out) throw std::runtime_error("vk.capture: failed to write " + path.string());
+        }
+
+        [[nodiscard]] std::uint64_t write_image_file(const TrajectoryDesc& desc, const WriterJob& job) {
+            const bool ppm  = desc.format == ImageSequenceFormat::Ppm;
+            const auto path = desc.output / std::format("{}{:06}.{}", desc.prefix, job.pose_index, ppm ? "ppm" : "rgba");
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            if (!out) throw std::runtime_error("vk.capture: failed to open " + path.string());
+
+            const bool bgra      = is_bgra(job.format);
+            const size_t texels  = static_cast<size_t>(job.extent.width) * job.extent.height;
+            const size_t channel = ppm ? 3 : 4;
+
+            std::string header;
+            if (ppm) header = std::format("P6\n{} {}\n255\n", job.extent.width, job.extent.height);
+            write_bytes(out, std::as_bytes(std::span{header}), path);
+
+            if (!ppm && !bgra) {
+                write_bytes(out, job.pixels, path);
+                return header.size() + job.pixels.size();
+            }
+
+            std::vector<std::byte> body(texels * channel);
+            for (size_t i = 0; i < texels; ++i) {
+                const std::byte* src = job.pixels.data() + i * 4;
+                std::byte* dst       = body.data() + i * channel;
+                dst[0]               = src[bgra ? 2 : 0];
+                dst[1]               = src[1];
+                dst[2]               = src[bgra ? 0 : 2];
+                if (channel == 4) dst[3] = src[3];
+            }
+            write_bytes(out, body, path);
+            return header.size() + body.size();
+        }
+
+        // BT.601 limited-range RGB -> YCbCr, written as three full-resolution planes.
+        [[nodiscard]] std::uint64_t write_y4m_frame(std::ofstream& out, const TrajectoryDesc& desc, const WriterJob& job, std::vector<std::byte>& planes) {
+            const bool bgra     = is_bgra(job.format);
+            const size_t texels = static_cast<size_t>(job.extent.width) * job.extent.height;
+            planes.resize(texels * 3);
+
+            for (size_t i = 0; i < texels; ++i) {
+                const auto* src = reinterpret_cast<const std::uint8_t*>(job.pixels.data()) + i * 4;
+                const int r     = src[bgra ? 2 : 0];
+                const int g     = src[1];
+                const int b     = src[bgra ? 0 : 2];
+
+                planes[i]              = static_cast<std::byte>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                planes[texels + i]     = static_cast<std::byte>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                planes[2 * texels + i] = static_cast<std::byte>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            }
+
+            constexpr std::string_view marker = "FRAME\n";
+            write_bytes(out, std::as_bytes(std::span{marker}), desc.output);
+            write_bytes(out, planes, desc.output);
+            return marker.size() + planes.size();
+        }
+
+        void run_writer(const std::stop_token stop, SequenceWriter& w, const TrajectoryDesc& desc) {
+            std::ofstream stream;
+            std::vector<std::byte> scratch;
+
+            for (;;) {
+                WriterJob job;
+                {
+                    std::unique_lock lock(w.mutex);
+                    w.ready.wait(lock, stop, [&] { return !w.queue.empty() || w.closed; });
+                    if (w.queue.empty()) return;
+                    job = std::move(w.queue.front());
+                    w.queue.pop_front();
+                }
+                w.space.notify_one();
+
+                try {
+                    if (desc.format != ImageSequenceFormat::Y4m) {
+                        w.bytes_written += write_image_file(desc, job);
+                        continue;
+                    }
+                    if (!stream.is_open()) {
+                        stream.open(desc.output, std::ios::binary | std::ios::trunc);
+                        if (!stream) throw std::runtime_error("vk.capture: failed to open " + desc.output.string());
+                        const std::string header = std::format("YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C444\n", job.extent.width, job.extent.height, desc.y4m_fps);
+                        write_bytes(stream, std::as_bytes(std::span{header}), desc.output);
+                        w.bytes_written += header.size();
+                    }
+                    w.bytes_written += write_y4m_frame(stream, desc, job, scratch);
+                } catch (...) {
+                    std::scoped_lock lock(w.mutex);
+                    w.error = std::current_exception();
+                    w.space.notify_all();
+                    return;
+                }
+            }
+        }
+
+        void push_frame(SequenceWriter& w, WriterJob job) {
+            std::unique_lock lock(w.mutex);
+            w.space.wait(lock, [&] { return w.queue.size() < w.max_queued || w.error; });
+            if (w.error) std::rethrow_exception(w.error);
+            w.queue.push_back(std::move(job));
+            w.ready.notify_one();
+        }
+
+        void prepare_output(const TrajectoryDesc& desc) {
+            if (desc.output.empty()) throw std::runtime_error("vk.capture: output path is empty");
+            const auto dir = desc.format == ImageSequenceFormat::Y4m ? desc.output.parent_path() : desc.output;
+            if (!dir.empty()) std::filesystem::create_directories(dir);
+        }
+    } // namespace
+
+    CaptureReport render_trajectory(const context::VulkanContext& vkctx, const TrajectoryDesc& desc, const std::function<void(TrajectoryFrame&)>& record) {
+        if (desc.poses.empty()) return {};
+        if (desc.frames_in_flight == 0) throw std::runtime_error("vk.capture: frames_in_flight must be at least 1");
+        prepare_output(desc);
+
+        // One offscreen image per frame in flight, so no frame waits on another frame's image.
+        auto target = swapchain::setup_offscreen(vkctx, desc.extent, desc.frames_in_flight);
+        auto frames = frame::create_frame_system(vkctx, target, desc.frames_in_flight, 4ull << 20, frame::PacingMode::Timeline);
+
+        SequenceWriter writer{};
+        writer.max_queued = std::max<std::size_t>(desc.max_queued_frames, 1);
+        std::jthread disk([&](const std::stop_token stop) { run_writer(stop, writer, desc); });
+
+        // Serials start at 1 on a fresh frame system and offscreen acquires never fail,
+        // so serial - 1 is the pose index.
+        frame::enable_readback(frames, [&](const frame::ReadbackView& v) {
+            WriterJob job{
+                .pose_index = static_cast<uint32_t>(v.frame_serial - 1),
+                .extent     = v.extent,
+                .format     = v.format,
+                .pixels     = {v.pixels.begin(), v.pixels.end()},
+            };
+            push_frame(writer, std::move(job));
+        });
+
+        camera::Camera cam;
+        cam.set_config(desc.camera);
+
+        using clock      = std::chrono::steady_clock;
+        const auto start = clock::now();
+
+        try {
+            for (uint32_t i = 0; i < desc.poses.size(); ++i) {
+                const uint32_t frame_index = i % desc.frames_in_flight;
+                const auto acquired        = frame::begin_frame(vkctx, target, frames, frame_index);
+                frame::begin_commands(frames, frame_index);
+
+                cam.set_state(desc.poses[i]);
+                cam.update(0.0f, desc.extent.width, desc.extent.height, camera::CameraInput{});
+
+                TrajectoryFrame tf{
+                    .frames      = frames,
+                    .target      = target,
+                    .frame_index = frame_index,
+                    .image_index = acquired.image_index,
+                    .pose_index  = i,
+                    .camera      = cam.matrices(),
+                };
+                record(tf);
+
+                frame::record_readback(vkctx, target, frames, frame_index, acquired.image_index);
+                (void) frame::end_frame(vkctx, target, frames, frame_index, acquired.image_index);
+            }
+            frame::flush_readbacks(vkctx, frames);
+        } catch (...) {
+            // frames and target are destroyed on the way out; let the GPU finish with them first.
+            vkctx.device.waitIdle();
+            throw;
+        }
+
+        {
+            std::scoped_lock lock(writer.mutex);
+            writer.closed = true;
+        }
+        writer.ready.notify_all();
+        disk.join();
+        if (writer.error) std::rethrow_exception(writer.error);
+
+        const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        return CaptureReport{
+            .frames        = static_cast<uint32_t>(desc.poses.size()),
+            .seconds       = seconds,
+            .fps           = seconds > 0.0 ? static_cast<double>(desc.poses.size()) / seconds : 0.0,
+            .bytes_written = writer.bytes_written,
+        };
+    }
+
+} // namespace vk::capture
@@ -7,22 +7,36 @@ module;
 
 #include <vulkan/vulkan_raii.hpp>
 module vk.context;
+import vk.memory;
 import std;
 
 namespace vk::context {
 
     struct DeviceCreatePolicy {
-        bool prefer_ext_dynamic_state = true;
-        bool want_fill_mode_non_solid = true;
-        bool want_sampler_anisotropy  = true;
+        bool prefer_ext_dynamic_state  = true;
+        bool prefer_ext_dynamic_state3 = true;
+        bool want_fill_mode_non_solid  = true;
+        bool want_sampler_anisotropy   = true;
+        bool require_wanted_features   = true; // false: wanted features the device lacks are skipped
 
         bool want_cuda_interop         = true;
         bool prefer_timeline_semaphore = true;
+        bool prefer_memory_budget      = true;
+        bool require_swapchain         = true;
+    };
+
+    struct QueueFamilySelection {
+        uint32_t graphics{0};
+        uint32_t transfer{0};
+        uint32_t compute{0};
     };
 
     struct DeviceExtensionPlan {
         std::vector<const char*> enabled_exts;
-        bool ext_dynamic_state_enabled = false;
+        bool ext_dynamic_state_enabled  = false;
+        bool ext_dynamic_state3_enabled = false;
+        bool memory_budget_enabled      = false;
+        bool dynamic_polygon_mode       = false; // filled in by create_logical_device_raii
     };
 
     namespace {
@@ -70,10 +84,10 @@ namespace vk::context {
             return std::ranges::any_of(exts, [name](const auto& e) { return std::strcmp(e.extensionName, name) == 0; });
         }
 
-        [[nodiscard]] bool meets_device_requirements(const raii::PhysicalDevice& device) {
+        [[nodiscard]] bool meets_device_requirements(const raii::PhysicalDevice& device, const bool need_swapchain) {
             if (device.getProperties().apiVersion < VK_API_VERSION_1_4) return false;
             if (!supports_graphics_queue(device)) return false;
-            if (!has_device_extension(device, KHRSwapchainExtensionName)) return false;
+            if (need_swapchain && !has_device_extension(device, KHRSwapchainExtensionName)) return false;
             return true;
         }
 
@@ -87,10 +101,49 @@ namespace vk::context {
             throw std::runtime_error("No queue family supports both graphics and present");
         }
 
+        [[nodiscard]] uint32_t find_graphics_queue_index(const raii::PhysicalDevice& device) {
+            const auto queue_families = device.getQueueFamilyProperties();
+            for (uint32_t i = 0; i < queue_families.size(); ++i) {
+                if (queue_families[i].queueFlags & QueueFlagBits::eGraphics) return i;
+            }
+            throw std::runtime_error("No queue family supports graphics");
+        }
+
+        [[nodiscard]] std::optional<uint32_t> find_queue_family(const std::vector<QueueFamilyProperties>& families, const QueueFlags required, const QueueFlags excluded) {
+            for (uint32_t i = 0; i < families.size(); ++i) {
+                const auto flags = families[i].queueFlags;
+                if (families[i].queueCount > 0 && (flags & required) == required && !(flags & excluded)) return i;
+            }
+            return std::nullopt;
+        }
+
+        [[nodiscard]] QueueFamilySelection select_queue_families(const raii::PhysicalDevice& device, const uint32_t graphics_family) {
+            const auto families = device.getQueueFamilyProperties();
+
+            QueueFamilySelection out{
+                .graphics = graphics_family,
+                .transfer = graphics_family,
+                .compute  = graphics_family,
+            };
+
+            // Prefer a pure DMA family for transfers, then any non-graphics family (compute families can copy too).
+            if (const auto f = find_queue_family(families, QueueFlagBits::eTransfer, QueueFlagBits::eGraphics | QueueFlagBits::eCompute)) {
+                out.transfer = *f;
+            } else if (const auto g = find_queue_family(families, QueueFlagBits::eTransfer, QueueFlagBits::eGraphics)) {
+                out.transfer = *g;
+            }
+
+            if (const auto f = find_queue_family(families, QueueFlagBits::eCompute, QueueFlagBits::eGraphics)) {
+                out.compute = *f;
+            }
+
+            return out;
+        }
+
         [[nodiscard]] auto build_feature_chain(const raii::PhysicalDevice& pd, const DeviceCreatePolicy& policy, const DeviceExtensionPlan& plan) {
             auto supported = pd.getFeatures2<PhysicalDeviceFeatures2, PhysicalDeviceVulkan11Features, PhysicalDeviceVulkan12Features, PhysicalDeviceVulkan13Features, PhysicalDeviceExtendedDynamicStateFeaturesEXT>();
 
-            StructureChain<PhysicalDeviceFeatures2, PhysicalDeviceVulkan11Features, PhysicalDeviceVulkan12Features, PhysicalDeviceVulkan13Features, PhysicalDeviceExtendedDynamicStateFeaturesEXT> enabled{{}, {}, {}, {}, {}};
+            StructureChain<PhysicalDeviceFeatures2, PhysicalDeviceVulkan11Features, PhysicalDeviceVulkan12Features, PhysicalDeviceVulkan13Features, PhysicalDeviceExtendedDynamicStateFeaturesEXT, PhysicalDeviceExtendedDynamicState3FeaturesEXT> enabled{{}, {}, {}, {}, {}, {}};
 
             enabled.get<PhysicalDeviceVulkan11Features>().shaderDrawParameters = VK_TRUE;
 
@@ -110,17 +163,19 @@ namespace vk::context {
             }
 
             if (policy.want_fill_mode_non_solid) {
-                if (!supported.get<PhysicalDeviceFeatures2>().features.fillModeNonSolid) {
+                const bool ok = supported.get<PhysicalDeviceFeatures2>().features.fillModeNonSolid;
+                if (!ok && policy.require_wanted_features) {
                     throw std::runtime_error("Device does not support fillModeNonSolid");
                 }
-                enabled.get<PhysicalDeviceFeatures2>().features.fillModeNonSolid = VK_TRUE;
+                enabled.get<PhysicalDeviceFeatures2>().features.fillModeNonSolid = ok;
             }
 
             if (policy.want_sampler_anisotropy) {
-                if (!supported.get<PhysicalDeviceFeatures2>().features.samplerAnisotropy) {
+                const bool ok = supported.get<PhysicalDeviceFeatures2>().features.samplerAnisotropy;
+                if (!ok && policy.require_wanted_features) {
                     throw std::runtime_error("Device does not support samplerAnisotropy");
                 }
-                enabled.get<PhysicalDeviceFeatures2>().features.samplerAnisotropy = VK_TRUE;
+                enabled.get<PhysicalDeviceFeatures2>().features.samplerAnisotropy = ok;
             }
 
             if (plan.ext_dynamic_state_enabled) {
@@ -130,6 +185,14 @@ namespace vk::context {
                 enabled.get<PhysicalDeviceExtendedDynamicStateFeaturesEXT>().extendedDynamicState = VK_TRUE;
             }
 
+            // Queried separately: the struct may only be chained when the extension is enabled.
+            if (plan.ext_dynamic_state3_enabled) {
+                const auto eds3 = pd.getFeatures2<PhysicalDeviceFeatures2, PhysicalDeviceExtendedDynamicState3FeaturesEXT>().get<PhysicalDeviceExtendedDynamicState3FeaturesEXT>();
+                enabled.get<PhysicalDeviceExtendedDynamicState3FeaturesEXT>().extendedDynamicState3PolygonMode = eds3.extendedDynamicState3PolygonMode;
+            } else {
+                enabled.unlink<PhysicalDeviceExtendedDynamicState3FeaturesEXT>();
+            }
+
             return enabled;
         }
 
@@ -180,12 +243,20 @@ namespace vk::context {
             return true;
         };
 
-        require(vk::KHRSwapchainExtensionName);
+        if (policy.require_swapchain) require(vk::KHRSwapchainExtensionName);
 
         if (policy.prefer_ext_dynamic_state) {
             plan.ext_dynamic_state_enabled = enable_if(vk::EXTExtendedDynamicStateExtensionName);
         }
 
+        if (policy.prefer_ext_dynamic_state3) {
+            plan.ext_dynamic_state3_enabled = enable_if(vk::EXTExtendedDynamicState3ExtensionName);
+        }
+
+        if (policy.prefer_memory_budget) {
+            plan.memory_budget_enabled = enable_if(vk::EXTMemoryBudgetExtensionName);
+        }
+
         if (policy.want_cuda_interop) {
             require(vk::KHRExternalMemoryExtensionName);
             require(vk::KHRExternalSemaphoreExtensionName);
@@ -219,7 +290,7 @@ namespace vk::context {
             .enabledExtensionCount   = static_cast<uint32_t>(required_extensions.size()),
             .ppEnabledExtensionNames = required_extensions.data(),
         };
-        return {context, createInfo};
+        return {context, createInfo, memory::host_allocation_callbacks()};
     }
 
     raii::DebugUtilsMessengerEXT create_debug_messenger_raii(const raii::Instance& instance) {
@@ -251,55 +322,171 @@ namespace vk::context {
         return std::make_tuple(std::move(surface), std::move(window), framebuffer_extent(window));
     }
 
-    raii::PhysicalDevice pick_physical_device_raii(const raii::Instance& instance) {
+    raii::PhysicalDevice pick_physical_device_raii(const raii::Instance& instance, const bool need_swapchain) {
         const auto devices = instance.enumeratePhysicalDevices();
-        if (const auto it = std::ranges::find_if(devices, meets_device_requirements); it != devices.end()) {
+        if (const auto it = std::ranges::find_if(devices, [&](const auto& d) { return meets_device_requirements(d, need_swapchain); }); it != devices.end()) {
             return *it;
         }
         throw std::runtime_error("failed to find a suitable GPU");
     }
 
-    auto create_logical_device_raii(const raii::PhysicalDevice& physical_device, const raii::SurfaceKHR& surface, const DeviceCreatePolicy& policy) {
-        const uint32_t graphics_queue_index = find_graphics_present_queue_index(physical_device, surface);
+    auto create_logical_device_raii(const raii::PhysicalDevice& physical_device, const uint32_t graphics_queue_index, const DeviceCreatePolicy& policy) {
+        const QueueFamilySelection families = select_queue_families(physical_device, graphics_queue_index);
 
-        const auto ext_plan = build_device_extensions(physical_device, policy);
-        auto features       = build_feature_chain(physical_device, policy, ext_plan);
+        auto ext_plan                 = build_device_extensions(physical_device, policy);
+        auto features                 = build_feature_chain(physical_device, policy, ext_plan);
+        ext_plan.dynamic_polygon_mode = ext_plan.ext_dynamic_state3_enabled && features.get<PhysicalDeviceExtendedDynamicState3FeaturesEXT>().extendedDynamicState3PolygonMode;
 
         constexpr std::array queue_priority{1.0f};
 
-        const DeviceQueueCreateInfo queue_ci{
-            .queueFamilyIndex = graphics_queue_index,
-            .queueCount       = 1,
-            .pQueuePriorities = queue_priority.data(),
-        };
+        std::vector<uint32_t> unique_families{families.graphics};
+        for (const uint32_t f : {families.transfer, families.compute}) {
+            if (std::ranges::find(unique_families, f) == unique_families.end()) unique_families.push_back(f);
+        }
+
+        std::vector<DeviceQueueCreateInfo> queue_cis;
+        queue_cis.reserve(unique_families.size());
+        for (const uint32_t f : unique_families) {
+            queue_cis.push_back(DeviceQueueCreateInfo{
+                .queueFamilyIndex = f,
+                .queueCount       = 1,
+                .pQueuePriorities = queue_priority.data(),
+            });
+        }
 
         const DeviceCreateInfo device_ci{
             .pNext                   = &features.get<PhysicalDeviceFeatures2>(),
-            .queueCreateInfoCount    = 1,
-            .pQueueCreateInfos       = &queue_ci,
+            .queueCreateInfoCount    = static_cast<uint32_t>(queue_cis.size()),
+            .pQueueCreateInfos       = queue_cis.data(),
             .enabledExtensionCount   = static_cast<uint32_t>(ext_plan.enabled_exts.size()),
             .ppEnabledExtensionNames = ext_plan.enabled_exts.data(),
         };
 
-        auto device         = raii::Device{physical_device, device_ci};
-        auto graphics_queue = raii::Queue{device, graphics_queue_index, 0};
+        auto device = raii::Device{physical_device, device_ci, memory::host_allocation_callbacks()};
 
-        return std::make_tuple(std::move(device), std::move(graphics_queue), graphics_queue_index, ext_plan.enabled_exts);
+        return std::make_tuple(std::move(device), families, ext_plan);
     }
 
-    raii::CommandPool create_command_pool_raii(const raii::Device& device, const uint32_t graphics_queue_index) {
+    raii::CommandPool create_command_pool_raii(const raii::Device& device, const uint32_t queue_family_index) {
         const CommandPoolCreateInfo ci{
             .flags            = CommandPoolCreateFlagBits::eResetCommandBuffer,
-            .queueFamilyIndex = graphics_queue_index,
+            .queueFamilyIndex = queue_family_index,
         };
         return {device, ci};
     }
+
+    bool has_dedicated_transfer_queue(const VulkanContext& vkctx) {
+        return vkctx.transfer_queue_index != vkctx.graphics_queue_index;
+    }
+
+    bool has_async_compute_queue(const VulkanContext& vkctx) {
+        return vkctx.compute_queue_index != vkctx.graphics_queue_index;
+    }
+
+    void release_buffer_ownership(const raii::CommandBuffer& cmd, const Buffer buffer, const DeviceSize offset, const DeviceSize size, const uint32_t src_family, const uint32_t dst_family, const PipelineStageFlags2 src_stage, const AccessFlags2 src_access) {
+        if (src_family == dst_family) return;
+
+        const BufferMemoryBarrier2 b{
+            .srcStageMask        = src_stage,
+            .srcAccessMask       = src_access,
+            .dstStageMask        = PipelineStageFlagBits2::eNone,
+            .dstAccessMask       = AccessFlagBits2::eNone,
+            .srcQueueFamilyIndex = src_family,
+            .dstQueueFamilyIndex = dst_family,
+            .buffer              = buffer,
+            .offset              = offset,
+            .size                = size,
+        };
+        cmd.pipelineBarrier2(DependencyInfo{.bufferMemoryBarrierCount = 1, .pBufferMemoryBarriers = &b});
+    }
+
+    void acquire_buffer_ownership(const raii::CommandBuffer& cmd, const Buffer buffer, const DeviceSize offset, const DeviceSize size, const uint32_t src_family, const uint32_t dst_family, const PipelineStageFlags2 dst_stage, const AccessFlags2 dst_access) {
+        if (src_family == dst_family) return;
+
+        const BufferMemoryBarrier2 b{
+            .srcStageMask        = PipelineStageFlagBits2::eNone,
+            .srcAccessMask       = AccessFlagBits2::eNone,
+            .dstStageMask        = dst_stage,
+            .dstAccessMask       = dst_access,
+            .srcQueueFamilyIndex = src_family,
+            .dstQueueFamilyIndex = dst_family,
+            .buffer              = buffer,
+            .offset              = offset,
+            .size                = size,
+        };
+        cmd.pipelineBarrier2(DependencyInfo{.bufferMemoryBarrierCount = 1, .pBufferMemoryBarriers = &b});
+    }
+
+    void release_image_ownership(const raii::CommandBuffer& cmd, const Image image, const ImageSubresourceRange& range, const ImageLayout old_layout, const ImageLayout new_layout, const uint32_t src_family, const uint32_t dst_family, const PipelineStageFlags2 src_stage, const AccessFlags2 src_access) {
+        if (src_family == dst_family) return;
+
+        const ImageMemoryBarrier2 b{
+            .srcStageMask        = src_stage,
+            .srcAccessMask       = src_access,
+            .dstStageMask        = PipelineStageFlagBits2::eNone,
+            .dstAccessMask       = AccessFlagBits2::eNone,
+            .oldLayout           = old_layout,
+            .newLayout           = new_layout,
+            .srcQueueFamilyIndex = src_family,
+            .dstQueueFamilyIndex = dst_family,
+            .image               = image,
+            .subresourceRange    = range,
+        };
+        cmd.pipelineBarrier2(DependencyInfo{.imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &b});
+    }
+
+    void acquire_image_ownership(const raii::CommandBuffer& cmd, const Image image, const ImageSubresourceRange& range, const ImageLayout old_layout, const ImageLayout new_layout, const uint32_t src_family, const uint32_t dst_family, const PipelineStageFlags2 dst_stage, const AccessFlags2 dst_access) {
+        const bool same_family = src_family == dst_family;
+        if (same_family && old_layout == new_layout) return;
+
+        const ImageMemoryBarrier2 b{
+            .srcStageMask        = same_family ? PipelineStageFlagBits2::eAllCommands : PipelineStageFlagBits2::eNone,
+            .srcAccessMask       = AccessFlagBits2::eNone,
+            .dstStageMask        = dst_stage,
+            .dstAccessMask       = dst_access,
+            .oldLayout           = old_layout,
+            .newLayout           = new_layout,
+            .srcQueueFamilyIndex = same_family ? VK_QUEUE_FAMILY_IGNORED : src_family,
+            .dstQueueFamilyIndex = same_family ? VK_QUEUE_FAMILY_IGNORED : dst_family,
+            .image               = image,
+            .subresourceRange    = range,
+        };
+        cmd.pipelineBarrier2(DependencyInfo{.imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &b});
+    }
+    void finish_context(VulkanContext& vk_context, raii::Device&& device, const QueueFamilySelection& families, const DeviceExtensionPlan& ext_plan) {
+        vk_context.device               = std::move(device);
+        vk_context.graphics_queue       = raii::Queue{vk_context.device, families.graphics, 0};
+        vk_context.graphics_queue_index = families.graphics;
+        vk_context.command_pool         = create_command_pool_raii(vk_context.device, vk_context.graphics_queue_index);
+
+        vk_context.transfer_queue        = raii::Queue{vk_context.device, families.transfer, 0};
+        vk_context.transfer_queue_index  = families.transfer;
+        vk_context.transfer_command_pool = create_command_pool_raii(vk_context.device, vk_context.transfer_queue_index);
+        vk_context.compute_queue         = raii::Queue{vk_context.device, families.compute, 0};
+        vk_context.compute_queue_index   = families.compute;
+        vk_context.compute_command_pool  = create_command_pool_raii(vk_context.device, vk_context.compute_queue_index);
+        vk_context.dynamic_polygon_mode  = ext_plan.dynamic_polygon_mode;
+
+        // The shared upload path stays on the graphics queue: texture mip generation needs blits,
+        // and the staging ring's timeline must only be signaled from one queue.
+        vk_context.allocator = memory::create_allocator(vk_context.physical_device, memory::AllocatorDesc{.use_memory_budget = ext_plan.memory_budget_enabled});
+        vk_context.staging   = memory::create_staging_ring(vk_context.allocator, vk_context.device, 64ull << 20);
+        vk_context.transfer  = memory::create_transfer_batcher(vk_context.device, vk_context.graphics_queue_index);
+    }
 } // namespace vk::context
 
 namespace {
     std::vector<const char*> required_layers() {
         return {"VK_LAYER_KHRONOS_validation"};
     }
+    std::vector<const char*> available_validation_layers(const vk::raii::Context& context) {
+        const auto props = context.enumerateInstanceLayerProperties();
+        std::vector<const char*> out;
+        for (const char* name : required_layers()) {
+            if (std::ranges::any_of(props, [&](const auto& p) { return std::strcmp(p.layerName, name) == 0; })) out.push_back(name);
+        }
+        return out;
+    }
     std::vector<const char*> required_extensions() {
         uint32_t glfw_extension_count = 0;
         const auto glfw_extensions    = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
@@ -323,23 +510,53 @@ std::pair<vk::context::VulkanContext, vk::context::SurfaceContext> vk::context::
     surface_context.window         = std::move(window);
     surface_context.extent         = extent;
 
-    vk_context.physical_device = pick_physical_device_raii(vk_context.instance);
+    vk_context.physical_device = pick_physical_device_raii(vk_context.instance, true);
 
     DeviceCreatePolicy policy{
         .prefer_ext_dynamic_state  = true,
+        .prefer_ext_dynamic_state3 = true,
         .want_fill_mode_non_solid  = true,
         .want_sampler_anisotropy   = true,
         .want_cuda_interop         = true,
         .prefer_timeline_semaphore = true,
+        .prefer_memory_budget      = true,
     };
 
-    auto [device, graphics_queue, graphics_queue_index, enabled_device_exts] = create_logical_device_raii(vk_context.physical_device, surface_context.surface, policy);
-    (void) enabled_device_exts;
-
-    vk_context.device               = std::move(device);
-    vk_context.graphics_queue       = std::move(graphics_queue);
-    vk_context.graphics_queue_index = graphics_queue_index;
-    vk_context.command_pool         = create_command_pool_raii(vk_context.device, vk_context.graphics_queue_index);
+    const uint32_t graphics_queue_index = find_graphics_present_queue_index(vk_context.physical_device, surface_context.surface);
+    auto [device, families, ext_plan]   = create_logical_device_raii(vk_context.physical_device, graphics_queue_index, policy);
+    finish_context(vk_context, std::move(device), families, ext_plan);
 
     return {std::move(vk_context), std::move(surface_context)};
 }
+
+vk::context::VulkanContext vk::context::setup_vk_context_headless(const std::string& app_name, const std::string& engine_name, const bool enable_validation) {
+    VulkanContext vk_context;
+
+    // Validation is optional here: CI images and software ICDs often ship without the layer.
+    const std::vector<const char*> layers = enable_validation ? available_validation_layers(vk_context.context) : std::vector<const char*>{};
+    std::vector<const char*> extensions;
+    if (!layers.empty()) extensions.push_back(vk::EXTDebugUtilsExtensionName);
+
+    vk_context.instance = create_instance_raii(vk_context.context, app_name.c_str(), engine_name.c_str(), layers, extensions);
+    if (!layers.empty()) vk_context.debug_messenger = create_debug_messenger_raii(vk_context.instance);
+
+    vk_context.physical_device = pick_physical_device_raii(vk_context.instance, false);
+
+    DeviceCreatePolicy policy{
+        .prefer_ext_dynamic_state  = true,
+        .prefer_ext_dynamic_state3 = true,
+        .want_fill_mode_non_solid  = true,
+        .want_sampler_anisotropy   = true,
+        .require_wanted_features   = false,
+        .want_cuda_interop         = false,
+        .prefer_timeline_semaphore = true,
+        .prefer_memory_budget      = true,
+        .require_swapchain         = false,
+    };
+
+    auto [device, families, ext_plan] = create_logical_device_raii(vk_context.physical_device, find_graphics_queue_index(vk_context.physical_device), policy);
+    finish_context(vk_context, std::move(device), families, ext_plan);
+
+    return vk_context;
+}
+
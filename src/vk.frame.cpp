@@ -2,6 +2,7 @@ module;
 #include <vulkan/vulkan_raii.hpp>
 module vk.frame;
 
+import vk.memory;
 import std;
 
 namespace vk::frame {
@@ -21,9 +22,156 @@ namespace vk::frame {
             return *frames.render_finished.at(image_index);
         }
 
+        [[nodiscard]] raii::CommandPool create_frame_pool(const context::VulkanContext& vkctx) {
+            const CommandPoolCreateInfo ci{
+                .flags            = CommandPoolCreateFlagBits::eTransient,
+                .queueFamilyIndex = vkctx.graphics_queue_index,
+            };
+            return {vkctx.device, ci};
+        }
+
+        void reset_frame_pools(FrameSystem& frames, const uint32_t frame_index) {
+            frames.command_pools.at(frame_index).reset();
+            for (uint32_t w = 0; w < frames.worker_count; ++w) {
+                auto& worker = frames.workers[frame_index * frames.worker_count + w];
+                worker.pool.reset();
+                worker.used = 0;
+            }
+        }
+
+        void collect_gpu_timings(FrameSystem& frames, const uint32_t frame_index) {
+            auto& p = frames.profiler;
+            if (p.pools.empty()) return;
+
+            auto& scopes = p.scopes.at(frame_index);
+            p.open.at(frame_index).clear();
+            if (scopes.empty()) return;
+
+            // Each query yields {timestamp, availability}, so a query that was never written (the end of
+            // an unclosed scope) costs only its own scope instead of failing the whole read with eNotReady.
+            const auto count       = static_cast<uint32_t>(scopes.size() * 2);
+            const auto [r, stamps] = p.pools[frame_index].getResults<std::uint64_t>(0, count, count * 2 * sizeof(std::uint64_t), 2 * sizeof(std::uint64_t), QueryResultFlagBits::e64 | QueryResultFlagBits::eWithAvailability);
+            if (r == Result::eSuccess || r == Result::eNotReady) {
+                const auto available = [&](const size_t q) { return stamps[2 * q + 1] != 0; };
+                p.last.clear();
+                p.last.reserve(scopes.size());
+                for (size_t i = 0; i < scopes.size(); ++i) {
+                    // Unclosed or unavailable scopes stay in the list with 0 ms so parent indices remain valid.
+                    const auto& s             = scopes[i];
+                    const bool valid          = s.closed && available(2 * i) && available(2 * i + 1);
+                    const std::uint64_t ticks = valid ? (stamps[4 * i + 2] - stamps[4 * i]) & p.valid_mask : 0;
+                    const double ms           = static_cast<double>(ticks) * p.ns_per_tick * 1e-6;
+                    p.last.push_back(GpuScopeResult{.name = s.name, .depth = s.depth, .parent = s.parent, .ms = ms});
+                    if (!valid) continue;
+
+                    auto [it, inserted] = p.average_ms.try_emplace(s.name, ms);
+                    if (!inserted) it->second += (ms - it->second) * p.smoothing;
+                }
+            }
+            scopes.clear();
+        }
+
+        void collect_readback(const context::VulkanContext& vkctx, FrameSystem& frames, const uint32_t frame_index) {
+            auto& rb = frames.readback;
+            if (frame_index >= rb.pending.size() || !rb.pending[frame_index].active) return;
+
+            auto& p         = rb.pending[frame_index];
+            const auto& buf = rb.buffers[frame_index];
+            p.active        = false;
+            memory::invalidate_mapped(vkctx.device, buf, 0, p.bytes);
+
+            const ReadbackView view{
+                .frame_serial = p.frame_serial,
+                .extent       = p.extent,
+                .format       = p.format,
+                .pixels       = std::span<const std::byte>{buf.mapped, static_cast<size_t>(p.bytes)},
+            };
+            if (rb.on_ready) {
+                rb.on_ready(view);
+                return;
+            }
+
+            if (rb.ready.size() >= rb.max_ready) rb.ready.pop_front();
+            rb.ready.push_back(ReadbackFrame{
+                .frame_serial = view.frame_serial,
+                .extent       = view.extent,
+                .format       = view.format,
+                .pixels       = {view.pixels.begin(), view.pixels.end()},
+            });
+        }
+
+        [[nodiscard]] uint32_t readback_texel_bytes(const Format format) {
+            switch (format) {
+            case Format::eR8G8B8A8Unorm:
+            case Format::eR8G8B8A8Srgb:
+            case Format::eB8G8R8A8Unorm:
+            case Format::eB8G8R8A8Srgb:
+            case Format::eA2B10G10R10UnormPack32: return 4;
+            case Format::eR16G16B16A16Sfloat: return 8;
+            case Format::eR32G32B32A32Sfloat: return 16;
+            default: throw std::runtime_error("vk.frame: unsupported readback format");
+            }
+        }
+
         [[nodiscard]] bool out_of_date_or_suboptimal(Result r) {
             return r == Result::eErrorOutOfDateKHR || r == Result::eSuboptimalKHR;
         }
+
+        using clock = std::chrono::steady_clock;
+
+        void add_phase(FrameSystem& frames, const FramePhase phase, const clock::time_point from, const clock::time_point to) {
+            frames.timing.ms[static_cast<size_t>(phase)] += std::chrono::duration<float, std::milli>(to - from).count();
+        }
+
+        void publish_timing(FrameSystem& frames) {
+            if (!frames.stats) return;
+            auto& st              = *frames.stats;
+            const std::uint64_t n = st.written.load(std::memory_order_relaxed);
+            auto& slot            = st.slots[n % FrameStats::capacity];
+
+            const std::uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+            slot.seq.store(seq + 1, std::memory_order_relaxed); // odd: write in progress
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < frame_phase_count; ++i) slot.ms[i].store(frames.timing.ms[i], std::memory_order_relaxed);
+            slot.seq.store(seq + 2, std::memory_order_release);
+
+            st.written.store(n + 1, std::memory_order_release);
+            frames.timing = {};
+        }
+
+        [[nodiscard]] std::vector<float> phase_samples(const FrameSystem& frames, const FramePhase phase, const std::uint32_t window) {
+            std::vector<float> out;
+            for (const auto& t : frame_timings(frames, window)) out.push_back(t.ms[static_cast<size_t>(phase)]);
+            return out;
+        }
+
+        [[nodiscard]] bool present_image(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, const Semaphore wait_sem, const uint32_t image_index) {
+            const SwapchainKHR swapchains[] = {*sc.handle};
+            const uint32_t indices[]        = {image_index};
+
+            const PresentInfoKHR present{
+                .waitSemaphoreCount = 1,
+                .pWaitSemaphores    = &wait_sem,
+                .swapchainCount     = 1,
+                .pSwapchains        = swapchains,
+                .pImageIndices      = indices,
+            };
+
+            try {
+                const Result r = vkctx.graphics_queue.presentKHR(present);
+                if (out_of_date_or_suboptimal(r)) return true;
+                if (r == Result::eErrorSurfaceLostKHR) return true;
+                if (r != Result::eSuccess) throw std::runtime_error("presentKHR failed");
+            } catch (const OutOfDateKHRError&) {
+                return true;
+            } catch (const SystemError& e) {
+                if (e.code().value() == static_cast<int>(Result::eErrorOutOfDateKHR)) return true;
+                if (e.code().value() == static_cast<int>(Result::eSuboptimalKHR)) return true;
+                throw;
+            }
+
+            return false;
+        }
     } // namespace
 
     raii::CommandBuffer& cmd(FrameSystem& frames, const uint32_t frame_index) {
@@ -34,19 +182,23 @@ namespace vk::frame {
         return frames.command_buffers.at(frame_index);
     }
 
-    FrameSystem create_frame_system(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, const uint32_t frames_in_flight) {
+    FrameSystem create_frame_system(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, const uint32_t frames_in_flight, const DeviceSize transient_bytes_per_frame, const PacingMode pacing) {
         if (frames_in_flight == 0) throw std::runtime_error("frames_in_flight must be > 0");
 
         FrameSystem out{};
         out.frames_in_flight = frames_in_flight;
 
-        {
+        out.command_pools.reserve(frames_in_flight);
+        out.command_buffers.reserve(frames_in_flight);
+        for (uint32_t i = 0; i < frames_in_flight; ++i) {
+            out.command_pools.push_back(create_frame_pool(vkctx));
+
             const CommandBufferAllocateInfo ai{
-                .commandPool        = *vkctx.command_pool,
+                .commandPool        = *out.command_pools.back(),
                 .level              = CommandBufferLevel::ePrimary,
-                .commandBufferCount = frames_in_flight,
+                .commandBufferCount = 1,
             };
-            out.command_buffers = vkctx.device.allocateCommandBuffers(ai);
+            out.command_buffers.push_back(std::move(vkctx.device.allocateCommandBuffers(ai).front()));
         }
 
         out.image_acquired.clear();
@@ -54,12 +206,36 @@ namespace vk::frame {
 
         out.image_acquired.reserve(frames_in_flight);
         out.in_flight.reserve(frames_in_flight);
+        out.slot_serial.assign(frames_in_flight, 0);
+        out.pacing = pacing;
+        out.stats  = std::make_unique<FrameStats>();
+
+        if (pacing == PacingMode::Timeline) {
+            const SemaphoreTypeCreateInfo type_ci{
+                .semaphoreType = SemaphoreType::eTimeline,
+                .initialValue  = 0,
+            };
+            out.frame_timeline = raii::Semaphore{vkctx.device, SemaphoreCreateInfo{.pNext = &type_ci}};
+        }
 
         for (uint32_t i = 0; i < frames_in_flight; ++i) {
             out.image_acquired.emplace_back(vkctx.device, SemaphoreCreateInfo{});
             out.in_flight.emplace_back(vkctx.device, FenceCreateInfo{.flags = FenceCreateFlagBits::eSignaled});
         }
 
+        if (transient_bytes_per_frame > 0) {
+            const auto limits       = vkctx.physical_device.getProperties().limits;
+            out.transient_alignment = std::max({limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment, DeviceSize{16}});
+
+            constexpr auto usage = BufferUsageFlagBits::eUniformBuffer | BufferUsageFlagBits::eStorageBuffer | BufferUsageFlagBits::eVertexBuffer | BufferUsageFlagBits::eIndexBuffer;
+            const uint32_t tag   = memory::register_tag(vkctx.allocator, "frame.transient");
+            out.transient.reserve(frames_in_flight);
+            for (uint32_t i = 0; i < frames_in_flight; ++i) {
+                out.transient.push_back(TransientArena{.buffer = memory::create_mapped_buffer(vkctx.allocator, vkctx.device, transient_bytes_per_frame, usage)});
+                memory::set_tag(out.transient.back().buffer.buffer.allocation, tag);
+            }
+        }
+
         on_swapchain_recreated(vkctx, sc, out);
         return out;
     }
@@ -68,6 +244,8 @@ namespace vk::frame {
         const auto image_count = static_cast<uint32_t>(sc.images.size());
         if (image_count == 0) throw std::runtime_error("swapchain has 0 images");
 
+        // Presents queued by earlier frames may still wait on the old semaphores.
+        if (!frames.render_finished.empty()) retire(frames, std::move(frames.render_finished));
         frames.render_finished.clear();
         frames.render_finished.reserve(image_count);
         for (uint32_t i = 0; i < image_count; ++i) {
@@ -75,20 +253,82 @@ namespace vk::frame {
         }
 
         frames.image_in_flight_frame.assign(image_count, invalid_u32);
+        frames.image_serial.assign(image_count, 0);
         frames.swapchain_image_layout.assign(image_count, ImageLayout::eUndefined);
     }
 
+    void recreate_swapchain(const context::VulkanContext& vkctx, context::SurfaceContext& sctx, swapchain::Swapchain& sc, FrameSystem& frames) {
+        // Stamped with the newest submitted frame, which is the last one to use the old images.
+        // Depth memory is handed over only when that frame has already retired.
+        const bool idle = is_frame_complete(frames, frames.frame_serial);
+        retire(frames, swapchain::recreate_swapchain(vkctx, sctx, sc, idle));
+        on_swapchain_recreated(vkctx, sc, frames);
+    }
+
     AcquireResult begin_frame(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, FrameSystem& frames, const uint32_t frame_index) {
         AcquireResult out{};
 
-        const Fence fence = in_flight_fence(frames, frame_index);
+        if (frames.limiter.interval.count() > 0) {
+            const auto t_limit = clock::now();
+            const auto target  = frames.limiter.next;
+            if (t_limit < target) {
+                // Sleep coarsely, then yield for the last stretch to hit the deadline closely.
+                if (target - t_limit > std::chrono::milliseconds{2}) std::this_thread::sleep_until(target - std::chrono::milliseconds{1});
+                while (clock::now() < target) std::this_thread::yield();
+            }
+            frames.limiter.next = std::max(target, t_limit) + frames.limiter.interval;
+            add_phase(frames, FramePhase::Limit, t_limit, clock::now());
+        }
 
-        (void) vkctx.device.waitForFences(fence, VK_TRUE, UINT64_MAX);
-        vkctx.device.resetFences(fence);
+        const auto t_begin = clock::now();
+        if (frames.frame_begin != clock::time_point{}) add_phase(frames, FramePhase::Frame, frames.frame_begin, t_begin);
+        frames.frame_begin = t_begin;
+
+        const bool timeline = frames.pacing == PacingMode::Timeline;
+        const Fence fence   = in_flight_fence(frames, frame_index);
+
+        if (timeline) {
+            // Frame N may start once frame N - frames_in_flight has retired, and the slot only once
+            // its own last submission has; the two differ after an out-of-date rollback.
+            const std::uint64_t next = frames.frame_serial + 1;
+            const std::uint64_t wait = std::max(next > frames.frames_in_flight ? next - frames.frames_in_flight : 0, frames.slot_serial.at(frame_index));
+            if (wait > 0) wait_frame(vkctx, frames, wait);
+        } else {
+            (void) vkctx.device.waitForFences(fence, VK_TRUE, UINT64_MAX);
+            // Frames are submitted in order on one queue, so this slot's fence covers every older frame.
+            frames.completed_serial = std::max(frames.completed_serial, frames.slot_serial.at(frame_index));
+        }
+        add_phase(frames, FramePhase::Wait, t_begin, clock::now());
 
-        const ResultValue<uint32_t> acquired = sc.handle.acquireNextImage(UINT64_MAX, acquire_semaphore(frames, frame_index), nullptr);
+        reset_frame_pools(frames, frame_index);
+        collect_gpu_timings(frames, frame_index);
+        collect_readback(vkctx, frames, frame_index);
+
+        if (frame_index < frames.transient.size()) {
+            auto& arena = frames.transient[frame_index];
+            arena.head  = 0;
+            arena.buffer.dirty.clear();
+        }
+
+        const std::uint64_t prev_slot_serial = frames.slot_serial.at(frame_index);
+        frames.slot_serial.at(frame_index)   = ++frames.frame_serial;
+        collect_retired(vkctx, frames);
+
+        // Offscreen chains own their images: cycle through them instead of acquiring.
+        const auto t_acquire           = clock::now();
+        ResultValue<uint32_t> acquired = {Result::eSuccess, 0};
+        if (swapchain::is_offscreen(sc)) {
+            acquired.value = frames.next_offscreen_image++ % static_cast<uint32_t>(sc.images.size());
+        } else {
+            acquired = sc.handle.acquireNextImage(UINT64_MAX, acquire_semaphore(frames, frame_index), nullptr);
+        }
+        const auto t_acquired = clock::now();
+        add_phase(frames, FramePhase::Acquire, t_acquire, t_acquired);
 
         if (acquired.result == Result::eErrorOutOfDateKHR) {
+            // Nothing will be submitted for this serial; hand it back so no one waits on it.
+            frames.slot_serial.at(frame_index) = prev_slot_serial;
+            --frames.frame_serial;
             out.need_recreate = true;
             return out;
         }
@@ -100,42 +340,361 @@ namespace vk::frame {
         out.image_index   = acquired.value;
         out.need_recreate = acquired.result == Result::eSuboptimalKHR;
 
-        const uint32_t prev_frame = frames.image_in_flight_frame.at(out.image_index);
-        if (prev_frame != invalid_u32) {
-            (void) vkctx.device.waitForFences(in_flight_fence(frames, prev_frame), VK_TRUE, UINT64_MAX);
+        // Reset only once a submission is guaranteed, otherwise an early return would leave it unsignaled.
+        if (!timeline) vkctx.device.resetFences(fence);
+
+        if (timeline) {
+            wait_frame(vkctx, frames, frames.image_serial.at(out.image_index));
+            frames.image_serial.at(out.image_index) = frames.frame_serial;
+        } else {
+            // This slot's own fence was waited above and has just been reset; waiting on it again would hang.
+            const uint32_t prev_frame = frames.image_in_flight_frame.at(out.image_index);
+            if (prev_frame != invalid_u32 && prev_frame != frame_index) {
+                (void) vkctx.device.waitForFences(in_flight_fence(frames, prev_frame), VK_TRUE, UINT64_MAX);
+            }
         }
 
         frames.image_in_flight_frame.at(out.image_index) = frame_index;
 
+        frames.record_begin = clock::now();
+        add_phase(frames, FramePhase::Wait, t_acquired, frames.record_begin);
+
+        return out;
+    }
+
+    bool is_frame_complete(FrameSystem& frames, const std::uint64_t serial) {
+        if (serial <= frames.completed_serial) return true;
+        if (frames.pacing != PacingMode::Timeline) return false;
+
+        frames.completed_serial = std::max(frames.completed_serial, frames.frame_timeline.getCounterValue());
+        return serial <= frames.completed_serial;
+    }
+
+    void wait_frame(const context::VulkanContext& vkctx, FrameSystem& frames, const std::uint64_t serial) {
+        if (serial <= frames.completed_serial) return;
+        if (frames.pacing != PacingMode::Timeline) throw std::runtime_error("vk.frame: wait_frame requires timeline pacing");
+
+        const Semaphore sem = *frames.frame_timeline;
+        const SemaphoreWaitInfo wi{
+            .semaphoreCount = 1,
+            .pSemaphores    = &sem,
+            .pValues        = &serial,
+        };
+        (void) vkctx.device.waitSemaphores(wi, UINT64_MAX);
+        frames.completed_serial = serial;
+    }
+
+    memory::TransferTicket frame_ticket(const FrameSystem& frames, const std::uint64_t serial) {
+        if (frames.pacing != PacingMode::Timeline) return {};
+        return memory::TransferTicket{
+            .semaphore = *frames.frame_timeline,
+            .value     = serial,
+        };
+    }
+
+    void collect_retired(const context::VulkanContext& vkctx, FrameSystem& frames) {
+        std::erase_if(frames.deletion.entries, [&](const DeletionQueue::Entry& e) {
+            if (e.frame_serial > frames.completed_serial) return false;
+            return memory::is_complete(vkctx.device, e.ticket);
+        });
+    }
+
+    void flush_retired(FrameSystem& frames) {
+        // Only valid once the device is idle.
+        frames.deletion.entries.clear();
+    }
+
+    TransientSlice allocate_transient(FrameSystem& frames, const uint32_t frame_index, const DeviceSize size, const DeviceSize alignment) {
+        if (frame_index >= frames.transient.size()) throw std::runtime_error("vk.frame: no transient arena for frame");
+        auto& arena = frames.transient[frame_index];
+
+        const DeviceSize a      = alignment == 0 ? frames.transient_alignment : alignment;
+        const DeviceSize offset = (arena.head + a - 1) / a * a;
+        if (offset + size > arena.buffer.buffer.size) throw std::runtime_error("vk.frame: transient arena exhausted");
+
+        arena.head       = offset + size;
+        arena.high_water = std::max(arena.high_water, arena.head);
+        memory::mark_dirty(arena.buffer, offset, size);
+
+        return TransientSlice{
+            .buffer = *arena.buffer.buffer.buffer,
+            .offset = offset,
+            .size   = size,
+            .mapped = arena.buffer.mapped + offset,
+        };
+    }
+
+    TransientSlice push_transient(FrameSystem& frames, const uint32_t frame_index, const std::span<const std::byte> bytes, const DeviceSize alignment) {
+        const TransientSlice out = allocate_transient(frames, frame_index, bytes.size_bytes(), alignment);
+        std::memcpy(out.mapped, bytes.data(), bytes.size_bytes());
         return out;
     }
 
     void begin_commands(FrameSystem& frames, const uint32_t frame_index) {
         auto& c = cmd(frames, frame_index);
-        c.reset();
         c.begin(CommandBufferBeginInfo{.flags = CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+        if (!frames.profiler.pools.empty()) c.resetQueryPool(*frames.profiler.pools.at(frame_index), 0, frames.profiler.max_scopes * 2);
+    }
+
+    void enable_readback(FrameSystem& frames, std::function<void(const ReadbackView&)> on_ready) {
+        auto& rb    = frames.readback;
+        rb.on_ready = std::move(on_ready);
+        rb.buffers.resize(frames.frames_in_flight);
+        rb.pending.assign(frames.frames_in_flight, {});
+    }
+
+    void record_readback(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, FrameSystem& frames, const uint32_t frame_index, const uint32_t image_index) {
+        auto& rb = frames.readback;
+        if (frame_index >= rb.pending.size()) throw std::runtime_error("vk.frame: readback is not enabled");
+
+        const DeviceSize bytes = static_cast<DeviceSize>(sc.extent.width) * sc.extent.height * readback_texel_bytes(sc.format);
+
+        auto& buf = rb.buffers[frame_index];
+        if (buf.buffer.size < bytes) {
+            // The previous buffer may still be the target of an older frame's copy.
+            retire(frames, std::move(buf));
+            buf = memory::create_mapped_buffer(vkctx.allocator, vkctx.device, bytes, BufferUsageFlagBits::eTransferDst, memory::HostAccess::Readback);
+            memory::set_tag(buf.buffer.allocation, memory::register_tag(vkctx.allocator, "frame.readback"));
+        }
+
+        const auto& c            = cmd(frames, frame_index);
+        const Image image        = sc.images.at(image_index);
+        const ImageLayout layout = frames.swapchain_image_layout.at(image_index);
+        constexpr ImageSubresourceRange color{ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+
+        const ImageMemoryBarrier2 to_transfer{
+            .srcStageMask     = PipelineStageFlagBits2::eAllCommands,
+            .srcAccessMask    = AccessFlagBits2::eMemoryWrite,
+            .dstStageMask     = PipelineStageFlagBits2::eCopy,
+            .dstAccessMask    = AccessFlagBits2::eTransferRead,
+            .oldLayout        = layout,
+            .newLayout        = ImageLayout::eTransferSrcOptimal,
+            .image            = image,
+            .subresourceRange = color,
+        };
+        c.pipelineBarrier2(DependencyInfo{.imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &to_transfer});
+
+        const BufferImageCopy region{
+            .bufferOffset      = 0,
+            .bufferRowLength   = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource  = ImageSubresourceLayers{ImageAspectFlagBits::eColor, 0, 0, 1},
+            .imageOffset       = Offset3D{0, 0, 0},
+            .imageExtent       = Extent3D{sc.extent.width, sc.extent.height, 1},
+        };
+        c.copyImageToBuffer(image, ImageLayout::eTransferSrcOptimal, *buf.buffer.buffer, region);
+
+        // Restore the tracked layout so the caller's present/transition logic is unaffected;
+        // an undefined layout cannot be restored, so it stays in transfer-src.
+        const ImageLayout restore = layout == ImageLayout::eUndefined ? ImageLayout::eTransferSrcOptimal : layout;
+        const ImageMemoryBarrier2 to_restore{
+            .srcStageMask     = PipelineStageFlagBits2::eCopy,
+            .srcAccessMask    = AccessFlagBits2::eTransferRead,
+            .dstStageMask     = PipelineStageFlagBits2::eAllCommands,
+            .dstAccessMask    = AccessFlagBits2::eMemoryRead | AccessFlagBits2::eMemoryWrite,
+            .oldLayout        = ImageLayout::eTransferSrcOptimal,
+            .newLayout        = restore,
+            .image            = image,
+            .subresourceRange = color,
+        };
+        const BufferMemoryBarrier2 to_host{
+            .srcStageMask  = PipelineStageFlagBits2::eCopy,
+            .srcAccessMask = AccessFlagBits2::eTransferWrite,
+            .dstStageMask  = PipelineStageFlagBits2::eHost,
+            .dstAccessMask = AccessFlagBits2::eHostRead,
+            .buffer        = *buf.buffer.buffer,
+            .offset        = 0,
+            .size          = bytes,
+        };
+        c.pipelineBarrier2(DependencyInfo{
+            .bufferMemoryBarrierCount = 1,
+            .pBufferMemoryBarriers    = &to_host,
+            .imageMemoryBarrierCount  = 1,
+            .pImageMemoryBarriers     = &to_restore,
+        });
+        frames.swapchain_image_layout.at(image_index) = restore;
+
+        rb.pending[frame_index] = FrameReadback::Pending{
+            .active       = true,
+            .frame_serial = frames.frame_serial,
+            .extent       = sc.extent,
+            .format       = sc.format,
+            .bytes        = bytes,
+        };
+    }
+
+    std::optional<ReadbackFrame> poll_readback(FrameSystem& frames) {
+        auto& ready = frames.readback.ready;
+        if (ready.empty()) return std::nullopt;
+        ReadbackFrame out = std::move(ready.front());
+        ready.pop_front();
+        return out;
+    }
+
+    void flush_readbacks(const context::VulkanContext& vkctx, FrameSystem& frames) {
+        auto& pending = frames.readback.pending;
+        std::vector<uint32_t> order;
+        for (uint32_t f = 0; f < pending.size(); ++f)
+            if (pending[f].active) order.push_back(f);
+        std::ranges::sort(order, {}, [&](const uint32_t f) { return pending[f].frame_serial; });
+
+        for (const uint32_t f : order) {
+            if (frames.pacing == PacingMode::Timeline) wait_frame(vkctx, frames, pending[f].frame_serial);
+            else (void) vkctx.device.waitForFences(in_flight_fence(frames, f), VK_TRUE, UINT64_MAX);
+            collect_readback(vkctx, frames, f);
+        }
+    }
+
+    void enable_gpu_profiler(const context::VulkanContext& vkctx, FrameSystem& frames, const uint32_t max_scopes) {
+        const auto families = vkctx.physical_device.getQueueFamilyProperties();
+        const uint32_t bits = families.at(vkctx.graphics_queue_index).timestampValidBits;
+        if (bits == 0) throw std::runtime_error("vk.frame: graphics queue does not support timestamps");
+
+        auto& p       = frames.profiler;
+        p.max_scopes  = max_scopes;
+        p.ns_per_tick = vkctx.physical_device.getProperties().limits.timestampPeriod;
+        p.valid_mask  = bits >= 64 ? ~0ull : (1ull << bits) - 1;
+
+        p.pools.clear();
+        p.pools.reserve(frames.frames_in_flight);
+        for (uint32_t i = 0; i < frames.frames_in_flight; ++i) {
+            p.pools.emplace_back(vkctx.device, QueryPoolCreateInfo{.queryType = QueryType::eTimestamp, .queryCount = max_scopes * 2});
+        }
+        p.scopes.assign(frames.frames_in_flight, {});
+        p.open.assign(frames.frames_in_flight, {});
+    }
+
+    void profile_begin(FrameSystem& frames, const uint32_t frame_index, const std::string_view name) {
+        auto& p = frames.profiler;
+        if (p.pools.empty()) return;
+
+        auto& scopes = p.scopes.at(frame_index);
+        auto& open   = p.open.at(frame_index);
+        if (scopes.size() >= p.max_scopes) {
+            open.push_back(-1); // over budget: keep begin/end balanced, record nothing
+            return;
+        }
+
+        const auto index = static_cast<int32_t>(scopes.size());
+        scopes.push_back(GpuProfiler::Scope{
+            .name   = std::string{name},
+            .depth  = static_cast<uint32_t>(open.size()),
+            .parent = open.empty() ? -1 : open.back(),
+        });
+        open.push_back(index);
+
+        cmd(frames, frame_index).writeTimestamp2(PipelineStageFlagBits2::eAllCommands, *p.pools[frame_index], static_cast<uint32_t>(index) * 2);
+    }
+
+    void profile_end(FrameSystem& frames, const uint32_t frame_index) {
+        auto& p = frames.profiler;
+        if (p.pools.empty()) return;
+
+        auto& open = p.open.at(frame_index);
+        if (open.empty()) throw std::runtime_error("vk.frame: profile_end without profile_begin");
+
+        const int32_t index = open.back();
+        open.pop_back();
+        if (index < 0) return;
+
+        p.scopes.at(frame_index)[index].closed = true;
+        cmd(frames, frame_index).writeTimestamp2(PipelineStageFlagBits2::eAllCommands, *p.pools[frame_index], static_cast<uint32_t>(index) * 2 + 1);
+    }
+
+    std::span<const GpuScopeResult> gpu_timings(const FrameSystem& frames) {
+        return frames.profiler.last;
+    }
+
+    void enable_parallel_recording(const context::VulkanContext& vkctx, FrameSystem& frames, const uint32_t worker_count) {
+        frames.workers.clear();
+        frames.worker_count = worker_count;
+        frames.workers.reserve(static_cast<size_t>(frames.frames_in_flight) * worker_count);
+        for (uint32_t i = 0; i < frames.frames_in_flight * worker_count; ++i) {
+            frames.workers.push_back(WorkerCommands{.pool = create_frame_pool(vkctx)});
+        }
+    }
+
+    const raii::CommandBuffer& begin_secondary(const context::VulkanContext& vkctx, FrameSystem& frames, const uint32_t frame_index, const uint32_t worker, const RenderingInheritance& inheritance) {
+        if (worker >= frames.worker_count) throw std::runtime_error("vk.frame: worker index out of range");
+        auto& w = frames.workers.at(frame_index * frames.worker_count + worker);
+
+        if (w.used == w.secondaries.size()) {
+            const CommandBufferAllocateInfo ai{
+                .commandPool        = *w.pool,
+                .level              = CommandBufferLevel::eSecondary,
+                .commandBufferCount = 1,
+            };
+            w.secondaries.push_back(std::move(vkctx.device.allocateCommandBuffers(ai).front()));
+        }
+        const auto& c = w.secondaries[w.used++];
+
+        const CommandBufferInheritanceRenderingInfo rendering{
+            .colorAttachmentCount    = static_cast<uint32_t>(inheritance.color_formats.size()),
+            .pColorAttachmentFormats = inheritance.color_formats.data(),
+            .depthAttachmentFormat   = inheritance.depth_format,
+            .stencilAttachmentFormat = inheritance.stencil_format,
+            .rasterizationSamples    = inheritance.samples,
+        };
+        const CommandBufferInheritanceInfo inherit{.pNext = &rendering};
+
+        c.begin(CommandBufferBeginInfo{
+            .flags            = CommandBufferUsageFlagBits::eOneTimeSubmit | CommandBufferUsageFlagBits::eRenderPassContinue,
+            .pInheritanceInfo = &inherit,
+        });
+        return c;
+    }
+
+    void execute_secondaries(FrameSystem& frames, const uint32_t frame_index) {
+        // Workers end their own buffers; the primary must be inside beginRendering with
+        // RenderingFlagBits::eContentsSecondaryCommandBuffers. Order is worker, then submission.
+        std::vector<CommandBuffer> handles;
+        for (uint32_t w = 0; w < frames.worker_count; ++w) {
+            const auto& worker = frames.workers[frame_index * frames.worker_count + w];
+            for (uint32_t i = 0; i < worker.used; ++i) handles.push_back(*worker.secondaries[i]);
+        }
+        if (!handles.empty()) cmd(frames, frame_index).executeCommands(handles);
     }
 
     bool end_frame(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, FrameSystem& frames, const uint32_t frame_index, const uint32_t image_index, const std::span<const SemaphoreSubmitInfo> extra_waits) {
+        const auto t_end = clock::now();
+        add_phase(frames, FramePhase::Record, frames.record_begin, t_end);
+
         auto& c = cmd(frames, frame_index);
         c.end();
 
+        if (frame_index < frames.transient.size()) memory::flush_mapped(vkctx.device, frames.transient[frame_index].buffer);
+
         const Semaphore wait_sem   = acquire_semaphore(frames, frame_index);
         const Semaphore signal_sem = render_finished_semaphore(frames, image_index);
         const Fence fence          = in_flight_fence(frames, frame_index);
 
+        const bool offscreen = swapchain::is_offscreen(sc);
+
         std::vector<SemaphoreSubmitInfo> waits;
         waits.reserve(1 + extra_waits.size());
-        waits.push_back(SemaphoreSubmitInfo{
-            .semaphore = wait_sem,
-            .stageMask = PipelineStageFlagBits2::eAllCommands,
-        });
+        if (!offscreen) {
+            waits.push_back(SemaphoreSubmitInfo{
+                .semaphore = wait_sem,
+                .stageMask = PipelineStageFlagBits2::eAllCommands,
+            });
+        }
         for (const auto& w : extra_waits) waits.push_back(w);
 
-        const SemaphoreSubmitInfo signal{
-            .semaphore = signal_sem,
-            .stageMask = PipelineStageFlagBits2::eAllCommands,
+        const std::array signals{
+            SemaphoreSubmitInfo{
+                .semaphore = signal_sem,
+                .stageMask = PipelineStageFlagBits2::eAllCommands,
+            },
+            SemaphoreSubmitInfo{
+                .semaphore = frames.pacing == PacingMode::Timeline ? *frames.frame_timeline : Semaphore{},
+                .value     = frames.frame_serial,
+                .stageMask = PipelineStageFlagBits2::eAllCommands,
+            },
         };
+        // signals[0] feeds present, signals[1] is the frame timeline.
+        const uint32_t first_signal = offscreen ? 1u : 0u;
+        const uint32_t signal_count = (offscreen ? 0u : 1u) + (frames.pacing == PacingMode::Timeline ? 1u : 0u);
 
         const CommandBufferSubmitInfo cb{
             .commandBuffer = *c,
@@ -146,37 +705,83 @@ namespace vk::frame {
             .pWaitSemaphoreInfos      = waits.data(),
             .commandBufferInfoCount   = 1,
             .pCommandBufferInfos      = &cb,
-            .signalSemaphoreInfoCount = 1,
-            .pSignalSemaphoreInfos    = &signal,
+            .signalSemaphoreInfoCount = signal_count,
+            .pSignalSemaphoreInfos    = signals.data() + first_signal,
         };
 
-        vkctx.graphics_queue.submit2(submit, fence);
+        vkctx.graphics_queue.submit2(submit, frames.pacing == PacingMode::Timeline ? Fence{} : fence);
+        const auto t_submitted = clock::now();
+        add_phase(frames, FramePhase::Submit, t_end, t_submitted);
 
-        const SwapchainKHR swapchains[] = {*sc.handle};
-        const uint32_t indices[]        = {image_index};
+        const bool need_recreate = !offscreen && present_image(vkctx, sc, signal_sem, image_index);
+        const auto t_presented   = clock::now();
+        add_phase(frames, FramePhase::Present, t_submitted, t_presented);
+        if (!offscreen) {
+            if (frames.last_present != clock::time_point{}) add_phase(frames, FramePhase::PresentInterval, frames.last_present, t_presented);
+            frames.last_present = t_presented;
+        }
+        publish_timing(frames);
 
-        const PresentInfoKHR present{
-            .waitSemaphoreCount = 1,
-            .pWaitSemaphores    = &signal_sem,
-            .swapchainCount     = 1,
-            .pSwapchains        = swapchains,
-            .pImageIndices      = indices,
-        };
+        return need_recreate;
+    }
+
+    void set_frame_limit(FrameSystem& frames, const double max_fps) {
+        frames.limiter.interval = max_fps > 0.0 ? std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(1.0 / max_fps)) : std::chrono::nanoseconds{0};
+        frames.limiter.next     = clock::now();
+    }
+
+    std::vector<FrameTiming> frame_timings(const FrameSystem& frames, const std::uint32_t window) {
+        std::vector<FrameTiming> out;
+        if (!frames.stats) return out;
+
+        const auto& st        = *frames.stats;
+        const std::uint64_t n = st.written.load(std::memory_order_acquire);
+        const std::uint64_t k = std::min<std::uint64_t>({n, window, FrameStats::capacity});
+        out.reserve(static_cast<size_t>(k));
 
-        try {
-            const Result r = vkctx.graphics_queue.presentKHR(present);
-            if (out_of_date_or_suboptimal(r)) return true;
-            if (r == Result::eErrorSurfaceLostKHR) return true;
-            if (r != Result::eSuccess) throw std::runtime_error("presentKHR failed");
-        } catch (const OutOfDateKHRError&) {
-            return true;
-        } catch (const SystemError& e) {
-            if (e.code().value() == static_cast<int>(Result::eErrorOutOfDateKHR)) return true;
-            if (e.code().value() == static_cast<int>(Result::eSuboptimalKHR)) return true;
-            throw;
+        for (std::uint64_t i = n - k; i < n; ++i) {
+            const auto& slot           = st.slots[i % FrameStats::capacity];
+            const std::uint64_t before = slot.seq.load(std::memory_order_acquire);
+            if (before & 1) continue;
+
+            FrameTiming t{};
+            for (size_t p = 0; p < frame_phase_count; ++p) t.ms[p] = slot.ms[p].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != before) continue; // overwritten while reading
+            out.push_back(t);
         }
+        return out;
+    }
+
+    float frame_percentile(const FrameSystem& frames, const FramePhase phase, const float percentile, const std::uint32_t window) {
+        auto samples = phase_samples(frames, phase, window);
+        if (samples.empty()) return 0.0f;
 
-        return false;
+        const float p    = std::clamp(percentile, 0.0f, 100.0f) / 100.0f;
+        const auto index = static_cast<size_t>(std::ceil(p * static_cast<float>(samples.size()))) - (p > 0.0f ? 1 : 0);
+        const auto nth   = samples.begin() + static_cast<std::ptrdiff_t>(std::min(index, samples.size() - 1));
+        std::ranges::nth_element(samples, nth);
+        return *nth;
+    }
+
+    FrameHistogram frame_histogram(const FrameSystem& frames, const FramePhase phase, const float bucket_ms, const std::uint32_t bucket_count, const std::uint32_t window) {
+        if (bucket_ms <= 0.0f) throw std::runtime_error("vk.frame: histogram bucket width must be > 0");
+
+        FrameHistogram out{};
+        out.bucket_ms = bucket_ms;
+        out.counts.assign(bucket_count, 0);
+
+        for (const float ms : phase_samples(frames, phase, window)) {
+            const auto bucket = static_cast<std::uint32_t>(std::max(ms, 0.0f) / bucket_ms);
+            if (bucket < bucket_count) {
+                ++out.counts[bucket];
+            } else {
+                ++out.overflow;
+            }
+            ++out.samples;
+        }
+        return out;
     }
 
 } // namespace vk::frame
@@ -0,0 +1,499 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+module vk.graph;
+
+import vk.context;
+import vk.frame;
+import vk.memory;
+import std;
+
+namespace vk::graph {
+
+    namespace {
+        constexpr AccessFlags2 write_access_mask = AccessFlagBits2::eColorAttachmentWrite | AccessFlagBits2::eDepthStencilAttachmentWrite | AccessFlagBits2::eShaderStorageWrite | AccessFlagBits2::eShaderWrite | AccessFlagBits2::eTransferWrite | AccessFlagBits2::eHostWrite | AccessFlagBits2::eMemoryWrite;
+
+        // Synchronization state of one resource while walking the live passes in order.
+        struct ResourceState {
+            bool touched{false};
+            ImageLayout layout{ImageLayout::eUndefined};
+            PipelineStageFlags2 write_stages{}; // later accesses wait on these
+            AccessFlags2 write_access{}; // writes still to be made visible
+            PipelineStageFlags2 read_stages{}; // readers since the last write, for write-after-read
+            PipelineStageFlags2 visible_stages{};
+            AccessFlags2 visible_access{};
+        };
+
+        // Span of a transient image over the live pass order.
+        struct Lifetime {
+            uint32_t first{invalid_resource};
+            uint32_t last{0};
+            PipelineStageFlags2 stages{};
+            AccessFlags2 writes{};
+            ImageUsageFlags usage{};
+        };
+
+        [[nodiscard]] bool image_only(const Use use) {
+            switch (use) {
+            case Use::ColorAttachment:
+            case Use::DepthAttachment:
+            case Use::DepthRead:
+            case Use::SampledFragment:
+            case Use::SampledCompute:
+            case Use::Present: return true;
+            default: return false;
+            }
+        }
+
+        [[nodiscard]] const GraphResource& resource_at(const RenderGraph& graph, const ResourceId id) {
+            if (id >= graph.resources.size()) throw std::runtime_error("vk.graph: invalid resource id");
+            return graph.resources[id];
+        }
+
+        [[nodiscard]] GraphResource& resource_at(RenderGraph& graph, const ResourceId id) {
+            if (id >= graph.resources.size()) throw std::runtime_error("vk.graph: invalid resource id");
+            return graph.resources[id];
+        }
+
+        [[nodiscard]] bool overlaps(const Lifetime& a, const Lifetime& b) {
+            return a.first <= b.last && b.first <= a.last;
+        }
+
+        [[nodiscard]] DeviceSize align_up(const DeviceSize v, const DeviceSize a) {
+            return a <= 1 ? v : (v + a - 1) / a * a;
+        }
+
+        void hash_combine(std::uint64_t& seed, const std::uint64_t v) {
+            seed ^= v + 0x9E37'79B9'7F4A'7C15ull + (seed << 6) + (seed >> 2);
+        }
+
+        void add_barrier(BarrierBatch& batch, const GraphResource& r, const PipelineStageFlags2 src_stages, const AccessFlags2 src_access, const PipelineStageFlags2 dst_stages, const AccessFlags2 dst_access, const ImageLayout old_layout, const ImageLayout new_layout) {
+            if (r.is_image) {
+                batch.images.push_back(ImageMemoryBarrier2{
+                    .srcStageMask     = src_stages,
+                    .srcAccessMask    = src_access,
+                    .dstStageMask     = dst_stages,
+                    .dstAccessMask    = dst_access,
+                    .oldLayout        = old_layout,
+                    .newLayout        = new_layout,
+                    .image            = r.image,
+                    .subresourceRange = ImageSubresourceRange{r.aspect, 0, RemainingMipLevels, 0, RemainingArrayLayers},
+                });
+                return;
+            }
+            batch.buffers.push_back(BufferMemoryBarrier2{
+                .srcStageMask  = src_stages,
+                .srcAccessMask = src_access,
+                .dstStageMask  = dst_stages,
+                .dstAccessMask = dst_access,
+                .buffer        = r.buffer,
+                .offset        = r.offset,
+                .size          = r.size,
+            });
+        }
+
+        // Emits a barrier only for write hazards, layout changes, or reads the previous
+        // barriers did not already make the data visible to.
+        void transition(BarrierBatch& batch, const GraphResource& r, ResourceState& s, const UseInfo& u) {
+            const ImageLayout layout = r.is_image ? u.layout : ImageLayout::eUndefined;
+            const bool relayout      = r.is_image && layout != s.layout;
+
+            if (u.writes || relayout) {
+                if (relayout || s.write_stages || s.read_stages) add_barrier(batch, r, s.write_stages | s.read_stages, s.write_access, u.stages, u.access, s.layout, layout);
+                s.layout         = layout;
+                s.write_stages   = u.stages;
+                s.write_access   = u.access & write_access_mask;
+                s.read_stages    = u.writes ? PipelineStageFlags2{} : u.stages;
+                s.visible_stages = u.stages;
+                s.visible_access = u.access;
+                return;
+            }
+
+            if ((u.stages & ~s.visible_stages) || (u.access & ~s.visible_access)) {
+                if (s.write_stages) add_barrier(batch, r, s.write_stages, s.write_access, u.stages, u.access, s.layout, s.layout);
+                s.visible_stages |= u.stages;
+                s.visible_access |= u.access;
+            }
+            s.read_stages |= u.stages;
+        }
+
+        // Reverse walk: a pass is live if it has side effects or writes a resource that is
+        // imported, marked as output, or accessed by a later live pass.
+        void cull(RenderGraph& graph) {
+            std::vector<bool> needed(graph.resources.size(), false);
+            for (size_t i = 0; i < graph.resources.size(); ++i) needed[i] = graph.resources[i].imported || graph.resources[i].output;
+
+            for (auto& pass : std::views::reverse(graph.passes)) {
+                pass.live = pass.side_effects;
+                for (const auto& a : pass.accesses)
+                    if (use_info(a.use).writes && needed[a.resource]) pass.live = true;
+                if (!pass.live) continue;
+                for (const auto& a : pass.accesses) needed[a.resource] = true;
+            }
+
+            graph.order.clear();
+            for (uint32_t i = 0; i < graph.passes.size(); ++i)
+                if (graph.passes[i].live) graph.order.push_back(i);
+        }
+
+        [[nodiscard]] std::vector<Lifetime> transient_lifetimes(const RenderGraph& graph) {
+            std::vector<Lifetime> out(graph.resources.size());
+            for (uint32_t pos = 0; pos < graph.order.size(); ++pos) {
+                for (const auto& a : graph.passes[graph.order[pos]].accesses) {
+                    if (graph.resources[a.resource].imported) continue;
+                    const UseInfo u = use_info(a.use);
+                    auto& l         = out[a.resource];
+                    l.first         = std::min(l.first, pos);
+                    l.last          = std::max(l.last, pos);
+                    l.stages |= u.stages;
+                    l.writes |= u.access & write_access_mask;
+                    l.usage |= u.image_usage;
+                }
+            }
+            return out;
+        }
+
+        // Greedy offset placement, largest first: each image takes the lowest offset that does
+        // not overlap an already placed image whose lifetime overlaps its own.
+        [[nodiscard]] TransientStorage build_transients(const context::VulkanContext& vkctx, const RenderGraph& graph, const std::vector<ResourceId>& used, const std::vector<Lifetime>& lifetimes, const std::uint64_t signature) {
+            TransientStorage out{};
+            out.signature = signature;
+            out.images.resize(used.size());
+
+            std::vector<MemoryRequirements> reqs(used.size());
+            for (size_t k = 0; k < used.size(); ++k) {
+                const auto& r  = graph.resources[used[k]];
+                auto& t        = out.images[k];
+                t.desc         = r.transient;
+                t.usage        = lifetimes[used[k]].usage | r.transient.extra_usage;
+                const auto ext = r.transient.extent;
+
+                const ImageCreateInfo ci{
+                    .imageType     = ImageType::e2D,
+                    .format        = r.transient.format,
+                    .extent        = Extent3D{ext.width, ext.height, 1},
+                    .mipLevels     = 1,
+                    .arrayLayers   = 1,
+                    .samples       = SampleCountFlagBits::e1,
+                    .tiling        = ImageTiling::eOptimal,
+                    .usage         = t.usage,
+                    .sharingMode   = SharingMode::eExclusive,
+                    .initialLayout = ImageLayout::eUndefined,
+                };
+                t.image = raii::Image{vkctx.device, ci};
+                reqs[k] = t.image.getMemoryRequirements();
+                t.size  = reqs[k].size;
+            }
+
+            std::vector<size_t> by_size(used.size());
+            std::iota(by_size.begin(), by_size.end(), size_t{0});
+            std::ranges::stable_sort(by_size, std::greater{}, [&](const size_t k) { return reqs[k].size; });
+
+            std::vector<size_t> placed;
+            uint32_t type_bits    = ~0u;
+            DeviceSize alignment  = 1;
+            DeviceSize block_size = 0;
+            for (const size_t k : by_size) {
+                if ((type_bits & reqs[k].memoryTypeBits) == 0) {
+                    out.images[k].dedicated = true;
+                    continue;
+                }
+                type_bits &= reqs[k].memoryTypeBits;
+                alignment = std::max(alignment, reqs[k].alignment);
+
+                DeviceSize offset = 0;
+                for (bool moved = true; moved;) {
+                    moved = false;
+                    for (const size_t p : placed) {
+                        const auto& o = out.images[p];
+                        if (!overlaps(lifetimes[used[k]], lifetimes[used[p]])) continue;
+                        if (offset >= o.offset + o.size || o.offset >= offset + reqs[k].size) continue;
+                        offset = align_up(o.offset + o.size, reqs[k].alignment);
+                        moved  = true;
+                    }
+                }
+                out.images[k].offset = offset;
+                block_size           = std::max(block_size, offset + reqs[k].size);
+                placed.push_back(k);
+            }
+
+            const uint32_t tag = memory::register_tag(vkctx.allocator, "graph.transient");
+            if (block_size > 0) {
+                const MemoryRequirements block_reqs{.size = block_size, .alignment = alignment, .memoryTypeBits = type_bits};
+                out.block = memory::allocate(vkctx.allocator, vkctx.device, block_reqs, MemoryPropertyFlagBits::eDeviceLocal, memory::ResourceKind::Optimal);
+                memory::set_tag(out.block, tag);
+            }
+
+            for (size_t k = 0; k < used.size(); ++k) {
+                auto& t = out.images[k];
+                if (t.dedicated) {
+                    out.dedicated.push_back(memory::allocate_for_image(vkctx.allocator, vkctx.device, t.image, MemoryPropertyFlagBits::eDeviceLocal));
+                    memory::set_tag(out.dedicated.back(), tag);
+                } else {
+                    t.image.bindMemory(out.block.memory, out.block.offset + t.offset);
+                }
+
+                const ImageViewCreateInfo view_ci{
+                    .image            = *t.image,
+                    .viewType         = ImageViewType::e2D,
+                    .format           = t.desc.format,
+                    .subresourceRange = ImageSubresourceRange{t.desc.aspect, 0, 1, 0, 1},
+                };
+                t.view = raii::ImageView{vkctx.device, view_ci};
+            }
+            return out;
+        }
+
+        void record_batch(const raii::CommandBuffer& cmd, const BarrierBatch& batch) {
+            if (batch.images.empty() && batch.buffers.empty()) return;
+            cmd.pipelineBarrier2(DependencyInfo{
+                .bufferMemoryBarrierCount = static_cast<uint32_t>(batch.buffers.size()),
+                .pBufferMemoryBarriers    = batch.buffers.data(),
+                .imageMemoryBarrierCount  = static_cast<uint32_t>(batch.images.size()),
+                .pImageMemoryBarriers     = batch.images.data(),
+            });
+        }
+    } // namespace
+
+    UseInfo use_info(const Use use) {
+        using S = PipelineStageFlagBits2;
+        using A = AccessFlagBits2;
+        using U = ImageUsageFlagBits;
+        switch (use) {
+        case Use::ColorAttachment: return {S::eColorAttachmentOutput, A::eColorAttachmentRead | A::eColorAttachmentWrite, ImageLayout::eColorAttachmentOptimal, U::eColorAttachment, true};
+        case Use::DepthAttachment: return {S::eEarlyFragmentTests | S::eLateFragmentTests, A::eDepthStencilAttachmentRead | A::eDepthStencilAttachmentWrite, ImageLayout::eDepthStencilAttachmentOptimal, U::eDepthStencilAttachment, true};
+        case Use::DepthRead: return {S::eEarlyFragmentTests | S::eLateFragmentTests | S::eFragmentShader, A::eDepthStencilAttachmentRead | A::eShaderSampledRead, ImageLayout::eDepthStencilReadOnlyOptimal, U::eDepthStencilAttachment | U::eSampled, false};
+        case Use::SampledFragment: return {S::eFragmentShader, A::eShaderSampledRead, ImageLayout::eShaderReadOnlyOptimal, U::eSampled, false};
+        case Use::SampledCompute: return {S::eComputeShader, A::eShaderSampledRead, ImageLayout::eShaderReadOnlyOptimal, U::eSampled, false};
+        case Use::StorageRead: return {S::eComputeShader, A::eShaderStorageRead, ImageLayout::eGeneral, U::eStorage, false};
+        case Use::StorageWrite: return {S::eComputeShader, A::eShaderStorageRead | A::eShaderStorageWrite, ImageLayout::eGeneral, U::eStorage, true};
+        case Use::TransferSrc: return {S::eAllTransfer, A::eTransferRead, ImageLayout::eTransferSrcOptimal, U::eTransferSrc, false};
+        case Use::TransferDst: return {S::eAllTransfer, A::eTransferWrite, ImageLayout::eTransferDstOptimal, U::eTransferDst, true};
+        case Use::VertexBuffer: return {S::eVertexAttributeInput, A::eVertexAttributeRead, ImageLayout::eUndefined, {}, false};
+        case Use::IndexBuffer: return {S::eIndexInput, A::eIndexRead, ImageLayout::eUndefined, {}, false};
+        case Use::UniformBuffer: return {S::eVertexShader | S::eFragmentShader | S::eComputeShader, A::eUniformRead, ImageLayout::eUndefined, {}, false};
+        case Use::IndirectBuffer: return {S::eDrawIndirect, A::eIndirectCommandRead, ImageLayout::eUndefined, {}, false};
+        case Use::Present: return {S::eNone, A::eNone, ImageLayout::ePresentSrcKHR, {}, false};
+        }
+        throw std::runtime_error("vk.graph: unknown use");
+    }
+
+    void reset(RenderGraph& graph) {
+        graph.resources.clear();
+        graph.passes.clear();
+        graph.order.clear();
+        graph.barriers.clear();
+        graph.final_barriers = {};
+        graph.compiled       = false;
+    }
+
+    ResourceId import_image(RenderGraph& graph, const std::string_view name, const Image image, const ImageView view, const Extent2D extent, const Format format, const ImageAspectFlags aspect, ImageLayout& tracked_layout, const ImageLayout final_layout) {
+        graph.resources.push_back(GraphResource{
+            .name           = std::string{name},
+            .is_image       = true,
+            .imported       = true,
+            .image          = image,
+            .view           = view,
+            .extent         = extent,
+            .format         = format,
+            .aspect         = aspect,
+            .tracked_layout = &tracked_layout,
+            .final_layout   = final_layout,
+        });
+        graph.compiled = false;
+        return static_cast<ResourceId>(graph.resources.size() - 1);
+    }
+
+    ResourceId import_buffer(RenderGraph& graph, const std::string_view name, const Buffer buffer, const DeviceSize offset, const DeviceSize size) {
+        graph.resources.push_back(GraphResource{
+            .name     = std::string{name},
+            .is_image = false,
+            .imported = true,
+            .buffer   = buffer,
+            .offset   = offset,
+            .size     = size,
+        });
+        graph.compiled = false;
+        return static_cast<ResourceId>(graph.resources.size() - 1);
+    }
+
+    ResourceId create_image(RenderGraph& graph, const std::string_view name, const TransientImageDesc& desc) {
+        if (desc.extent.width == 0 || desc.extent.height == 0 || desc.format == Format::eUndefined) throw std::runtime_error("vk.graph: transient image needs an extent and a format");
+        graph.resources.push_back(GraphResource{
+            .name      = std::string{name},
+            .is_image  = true,
+            .extent    = desc.extent,
+            .format    = desc.format,
+            .aspect    = desc.aspect,
+            .transient = desc,
+        });
+        graph.compiled = false;
+        return static_cast<ResourceId>(graph.resources.size() - 1);
+    }
+
+    void mark_output(RenderGraph& graph, const ResourceId resource) {
+        resource_at(graph, resource).output = true;
+        graph.compiled                      = false;
+    }
+
+    uint32_t add_pass(RenderGraph& graph, const std::string_view name, std::vector<PassAccess> accesses, PassFn execute, const bool side_effects) {
+        for (const auto& a : accesses) {
+            const auto& r = resource_at(graph, a.resource);
+            for (const auto& b : accesses)
+                if (b.resource == a.resource && r.is_image && use_info(b.use).layout != use_info(a.use).layout) throw std::runtime_error("vk.graph: pass '" + std::string{name} + "' uses image '" + r.name + "' in two layouts");
+            if (!r.is_image && image_only(a.use)) throw std::runtime_error("vk.graph: pass '" + std::string{name} + "' uses buffer '" + r.name + "' as an image");
+            if (r.is_image && use_info(a.use).layout == ImageLayout::eUndefined) throw std::runtime_error("vk.graph: pass '" + std::string{name} + "' uses image '" + r.name + "' as a buffer");
+        }
+        graph.passes.push_back(Pass{
+            .name         = std::string{name},
+            .accesses     = std::move(accesses),
+            .execute      = std::move(execute),
+            .side_effects = side_effects,
+        });
+        graph.compiled = false;
+        return static_cast<uint32_t>(graph.passes.size() - 1);
+    }
+
+    void compile(const context::VulkanContext& vkctx, frame::FrameSystem& frames, RenderGraph& graph) {
+        cull(graph);
+
+        // Transient storage is reused as long as the live transient set and lifetimes match.
+        const auto lifetimes = transient_lifetimes(graph);
+        std::vector<ResourceId> used;
+        std::uint64_t signature = 0;
+        for (ResourceId id = 0; id < graph.resources.size(); ++id) {
+            auto& r           = graph.resources[id];
+            r.transient_index = invalid_resource;
+            if (r.imported || lifetimes[id].first == invalid_resource) continue;
+
+            r.transient_index = static_cast<uint32_t>(used.size());
+            used.push_back(id);
+            const auto& l = lifetimes[id];
+            hash_combine(signature, r.transient.extent.width);
+            hash_combine(signature, r.transient.extent.height);
+            hash_combine(signature, static_cast<std::uint64_t>(r.transient.format));
+            hash_combine(signature, static_cast<VkImageAspectFlags>(r.transient.aspect));
+            hash_combine(signature, static_cast<VkImageUsageFlags>(l.usage | r.transient.extra_usage));
+            hash_combine(signature, l.first);
+            hash_combine(signature, l.last);
+        }
+        hash_combine(signature, used.size());
+
+        if (signature != graph.transient.signature || graph.transient.images.size() != used.size()) {
+            // Frames in flight may still be using the old images.
+            if (!graph.transient.images.empty()) frame::retire(frames, std::move(graph.transient));
+            graph.transient = build_transients(vkctx, graph, used, lifetimes, signature);
+        }
+
+        std::vector<ResourceState> states(graph.resources.size());
+        for (const ResourceId id : used) {
+            auto& r       = graph.resources[id];
+            const auto& t = graph.transient.images[r.transient_index];
+            r.image       = *t.image;
+            r.view        = *t.view;
+
+            // The image starts undefined each frame; its first barrier waits on every use of
+            // memory it shares, in this frame or the previous one on the same queue.
+            auto& s   = states[id];
+            s.touched = true;
+            for (const ResourceId other : used) {
+                const auto& o      = graph.transient.images[graph.resources[other].transient_index];
+                const bool aliased = !t.dedicated && !o.dedicated && o.offset < t.offset + t.size && t.offset < o.offset + o.size;
+                if (other != id && !aliased) continue;
+                s.write_stages |= lifetimes[other].stages;
+                s.write_access |= lifetimes[other].writes;
+            }
+        }
+
+        graph.barriers.assign(graph.order.size(), {});
+        for (uint32_t pos = 0; pos < graph.order.size(); ++pos) {
+            const auto& pass = graph.passes[graph.order[pos]];
+            for (const auto& a : pass.accesses) {
+                const auto& r = graph.resources[a.resource];
+                auto& s       = states[a.resource];
+                if (!s.touched) {
+                    // Imported: nothing is known about earlier work, so images wait on all
+                    // commands and buffers order writes after earlier reads. External writes
+                    // to imported buffers are synchronized by the caller (e.g. transfer tickets).
+                    s.touched = true;
+                    if (r.is_image) {
+                        s.layout       = *r.tracked_layout;
+                        s.write_stages = PipelineStageFlagBits2::eAllCommands;
+                        s.write_access = AccessFlagBits2::eMemoryWrite;
+                    } else {
+                        s.read_stages = PipelineStageFlagBits2::eAllCommands;
+                    }
+                }
+                transition(graph.barriers[pos], r, s, use_info(a.use));
+            }
+        }
+
+        graph.final_barriers = {};
+        for (ResourceId id = 0; id < graph.resources.size(); ++id) {
+            auto& r       = graph.resources[id];
+            const auto& s = states[id];
+            if (!r.imported || !r.is_image) continue;
+            if (!s.touched) {
+                r.end_layout = *r.tracked_layout;
+                continue;
+            }
+            r.end_layout = s.layout;
+            if (r.final_layout == ImageLayout::eUndefined || r.final_layout == s.layout) continue;
+
+            const bool present = r.final_layout == ImageLayout::ePresentSrcKHR;
+            add_barrier(graph.final_barriers, r, s.write_stages | s.read_stages, s.write_access, present ? PipelineStageFlagBits2::eNone : PipelineStageFlagBits2::eAllCommands, present ? AccessFlagBits2::eNone : AccessFlagBits2::eMemoryRead | AccessFlagBits2::eMemoryWrite, s.layout, r.final_layout);
+            r.end_layout = r.final_layout;
+        }
+
+        auto& st                     = graph.stats;
+        st                           = {};
+        st.passes                    = static_cast<uint32_t>(graph.order.size());
+        st.culled_passes             = static_cast<uint32_t>(graph.passes.size() - graph.order.size());
+        st.transient_bytes           = graph.transient.block.size;
+        st.transient_bytes_unaliased = 0;
+        for (const auto& t : graph.transient.images) {
+            st.transient_bytes_unaliased += t.size;
+            if (t.dedicated) st.transient_bytes += t.size;
+        }
+        const auto count_batch = [&](const BarrierBatch& b) {
+            if (b.images.empty() && b.buffers.empty()) return;
+            ++st.barrier_batches;
+            st.image_barriers += static_cast<uint32_t>(b.images.size());
+            st.buffer_barriers += static_cast<uint32_t>(b.buffers.size());
+        };
+        for (const auto& b : graph.barriers) count_batch(b);
+        count_batch(graph.final_barriers);
+
+        graph.compiled = true;
+    }
+
+    void execute(const RenderGraph& graph, const raii::CommandBuffer& cmd) {
+        if (!graph.compiled) throw std::runtime_error("vk.graph: execute() before compile()");
+
+        for (size_t pos = 0; pos < graph.order.size(); ++pos) {
+            record_batch(cmd, graph.barriers[pos]);
+            const auto& pass = graph.passes[graph.order[pos]];
+            if (pass.execute) pass.execute(cmd, graph);
+        }
+        record_batch(cmd, graph.final_barriers);
+
+        for (const auto& r : graph.resources)
+            if (r.tracked_layout) *r.tracked_layout = r.end_layout;
+    }
+
+    Image image(const RenderGraph& graph, const ResourceId resource) {
+        return resource_at(graph, resource).image;
+    }
+
+    ImageView view(const RenderGraph& graph, const ResourceId resource) {
+        return resource_at(graph, resource).view;
+    }
+
+    Buffer buffer(const RenderGraph& graph, const ResourceId resource) {
+        return resource_at(graph, resource).buffer;
+    }
+
+    Extent2D extent(const RenderGraph& graph, const ResourceId resource) {
+        return resource_at(graph, resource).extent;
+    }
+
+} // namespace vk::graph
@@ -1,17 +1,791 @@
 module;
 #include <vulkan/vulkan_raii.hpp>
 module vk.memory;
+import std;
 
 
+namespace vk::memory {
+    struct AllocatorState {
+        struct Block {
+            raii::DeviceMemory memory{nullptr};
+            DeviceSize size{0};
+            std::byte* mapped{nullptr};
+            uint32_t memory_type{0};
+            ResourceKind kind{ResourceKind::Linear};
+            bool dedicated{false};
+            uint32_t allocation_count{0};
+            DeviceSize used{0};
+            std::map<DeviceSize, DeviceSize> free_ranges; // offset -> size, coalesced on release
+        };
+
+        std::mutex mutex;
+        AllocatorDesc desc{};
+        PhysicalDeviceMemoryProperties properties{};
+        DeviceSize non_coherent_atom{1};
+        DeviceSize buffer_image_granularity{1};
+        std::vector<std::unique_ptr<Block>> blocks; // null slots are reused
+
+        struct TagCounters {
+            std::string name;
+            uint32_t allocation_count{0};
+            DeviceSize bytes{0};
+        };
+        std::vector<TagCounters> tags{TagCounters{.name = "untagged"}};
+    };
+} // namespace vk::memory
+
+namespace {
+    using Block = vk::memory::AllocatorState::Block;
+
+    [[nodiscard]] vk::DeviceSize align_up(const vk::DeviceSize value, const vk::DeviceSize alignment) {
+        if (alignment <= 1) return value;
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    [[nodiscard]] uint32_t find_memory_type_index(const vk::PhysicalDeviceMemoryProperties& mem, const uint32_t type_bits, const vk::MemoryPropertyFlags required) {
+        for (uint32_t i = 0; i < mem.memoryTypeCount; ++i) {
+            const bool type_ok = (type_bits & 1u << i) != 0;
+            if (const bool props_ok = (mem.memoryTypes[i].propertyFlags & required) == required; type_ok && props_ok) return i;
+        }
+        throw std::runtime_error("No suitable memory type");
+    }
+
+    [[nodiscard]] uint32_t find_memory_type_index(const vk::PhysicalDeviceMemoryProperties& mem, const uint32_t type_bits, const vk::MemoryPropertyFlags required, const vk::MemoryPropertyFlags preferred) {
+        if (preferred) {
+            for (uint32_t i = 0; i < mem.memoryTypeCount; ++i) {
+                const auto want = required | preferred;
+                if ((type_bits & 1u << i) != 0 && (mem.memoryTypes[i].propertyFlags & want) == want) return i;
+            }
+        }
+        return find_memory_type_index(mem, type_bits, required);
+    }
+
+    [[nodiscard]] vk::DeviceSize align_down(const vk::DeviceSize value, const vk::DeviceSize alignment) {
+        if (alignment <= 1) return value;
+        return value / alignment * alignment;
+    }
+
+    void append_dirty_ranges(const vk::memory::MappedBuffer& b, std::vector<vk::MappedMemoryRange>& out) {
+        if (b.coherent || b.dirty.empty()) return;
+
+        auto ranges = b.dirty;
+        std::ranges::sort(ranges);
+
+        // The allocation offset and size are atom aligned, so widening to atoms stays inside it.
+        const auto& a = b.buffer.allocation;
+        std::pair<vk::DeviceSize, vk::DeviceSize> cur{align_down(ranges.front().first, b.atom), std::min(align_up(ranges.front().second, b.atom), a.size)};
+        auto emit = [&] { out.push_back(vk::MappedMemoryRange{.memory = a.memory, .offset = a.offset + cur.first, .size = cur.second - cur.first}); };
+
+        for (const auto& [begin, end] : ranges | std::views::drop(1)) {
+            const vk::DeviceSize lo = align_down(begin, b.atom);
+            const vk::DeviceSize hi = std::min(align_up(end, b.atom), a.size);
+            if (lo <= cur.second) {
+                cur.second = std::max(cur.second, hi);
+            } else {
+                emit();
+                cur = {lo, hi};
+            }
+        }
+        emit();
+    }
+
+    struct HostCounters {
+        std::atomic<std::uint64_t> live_allocations{0};
+        std::atomic<std::uint64_t> live_bytes{0};
+        std::atomic<std::uint64_t> peak_bytes{0};
+        std::atomic<std::uint64_t> total_allocations{0};
+        std::atomic<std::uint64_t> internal_bytes{0};
+    };
+
+    HostCounters g_host{};
+
+    // Each block carries its size and alignment in front of the returned pointer.
+    struct HostHeader {
+        std::size_t size;
+        std::size_t alignment;
+    };
+
+    [[nodiscard]] std::size_t host_header_bytes(const std::size_t alignment) {
+        return std::max(alignment, sizeof(HostHeader));
+    }
+
+    [[nodiscard]] HostHeader& host_header(void* p) {
+        return *reinterpret_cast<HostHeader*>(static_cast<std::byte*>(p) - sizeof(HostHeader));
+    }
+
+    VKAPI_ATTR void* VKAPI_CALL host_allocate(void*, const std::size_t size, std::size_t alignment, VkSystemAllocationScope) {
+        if (size == 0) return nullptr;
+        alignment = std::max<std::size_t>(alignment, alignof(HostHeader));
+
+        const std::size_t header = host_header_bytes(alignment);
+        auto* raw                = static_cast<std::byte*>(::operator new(header + size, std::align_val_t{alignment}, std::nothrow));
+        if (!raw) return nullptr;
+
+        void* p        = raw + header;
+        host_header(p) = HostHeader{.size = size, .alignment = alignment};
+
+        const auto live = g_host.live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+        g_host.live_allocations.fetch_add(1, std::memory_order_relaxed);
+        g_host.total_allocations.fetch_add(1, std::memory_order_relaxed);
+        auto peak = g_host.peak_bytes.load(std::memory_order_relaxed);
+        while (live > peak && !g_host.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+        return p;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL host_free(void*, void* p) {
+        if (!p) return;
+        const HostHeader h = host_header(p);
+        g_host.live_bytes.fetch_sub(h.size, std::memory_order_relaxed);
+        g_host.live_allocations.fetch_sub(1, std::memory_order_relaxed);
+        ::operator delete(static_cast<std::byte*>(p) - host_header_bytes(h.alignment), std::align_val_t{h.alignment});
+    }
+
+    VKAPI_ATTR void* VKAPI_CALL host_reallocate(void* user, void* original, const std::size_t size, const std::size_t alignment, const VkSystemAllocationScope scope) {
+        if (!original) return host_allocate(user, size, alignment, scope);
+        if (size == 0) {
+            host_free(user, original);
+            return nullptr;
+        }
+        void* p = host_allocate(user, size, alignment, scope);
+        if (!p) return nullptr;
+        std::memcpy(p, original, std::min(size, host_header(original).size));
+        host_free(user, original);
+        return p;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL host_internal_allocate(void*, const std::size_t size, VkInternalAllocationType, VkSystemAllocationScope) {
+        g_host.internal_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    VKAPI_ATTR void VKAPI_CALL host_internal_free(void*, const std::size_t size, VkInternalAllocationType, VkSystemAllocationScope) {
+        g_host.internal_bytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+
+    const vk::AllocationCallbacks g_host_callbacks{
+        .pUserData             = nullptr,
+        .pfnAllocation         = host_allocate,
+        .pfnReallocation       = host_reallocate,
+        .pfnFree               = host_free,
+        .pfnInternalAllocation = host_internal_allocate,
+        .pfnInternalFree       = host_internal_free,
+    };
+
+    [[nodiscard]] vk::DeviceSize preferred_block_size(const vk::memory::AllocatorState& s, const uint32_t memory_type) {
+        const uint32_t heap            = s.properties.memoryTypes[memory_type].heapIndex;
+        const vk::DeviceSize heap_size = s.properties.memoryHeaps[heap].size;
+        if (heap_size <= s.desc.small_heap_limit) return std::max<vk::DeviceSize>(heap_size / 8, 1ull << 20);
+        return s.desc.block_size;
+    }
+
+    [[nodiscard]] uint32_t create_block(vk::memory::AllocatorState& s, const vk::raii::Device& device, const uint32_t memory_type, const vk::DeviceSize size, const vk::memory::ResourceKind kind, const bool dedicated) {
+        auto block = std::make_unique<Block>();
+
+        const vk::MemoryAllocateInfo mai{
+            .allocationSize  = size,
+            .memoryTypeIndex = memory_type,
+        };
+        block->memory      = vk::raii::DeviceMemory{device, mai, &g_host_callbacks};
+        block->size        = size;
+        block->memory_type = memory_type;
+        block->kind        = kind;
+        block->dedicated   = dedicated;
+        block->free_ranges.emplace(0, size);
+
+        // Host-visible blocks stay mapped for their whole lifetime; vkFreeMemory unmaps implicitly.
+        if (s.properties.memoryTypes[memory_type].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+            block->mapped = static_cast<std::byte*>(block->memory.mapMemory(0, VK_WHOLE_SIZE));
+        }
+
+        for (uint32_t i = 0; i < s.blocks.size(); ++i) {
+            if (!s.blocks[i]) {
+                s.blocks[i] = std::move(block);
+                return i;
+            }
+        }
+        s.blocks.push_back(std::move(block));
+        return static_cast<uint32_t>(s.blocks.size() - 1);
+    }
+
+    // Best-fit search over the block's free ranges.
+    [[nodiscard]] std::optional<vk::DeviceSize> suballocate(Block& block, const vk::DeviceSize size, const vk::DeviceSize alignment) {
+        auto best                     = block.free_ranges.end();
+        vk::DeviceSize best_range_len = std::numeric_limits<vk::DeviceSize>::max();
+
+        for (auto it = block.free_ranges.begin(); it != block.free_ranges.end(); ++it) {
+            const vk::DeviceSize aligned = align_up(it->first, alignment);
+            if (aligned + size <= it->first + it->second && it->second < best_range_len) {
+                best           = it;
+                best_range_len = it->second;
+            }
+        }
+        if (best == block.free_ranges.end()) return std::nullopt;
+
+        const auto [range_offset, range_len] = *best;
+        block.free_ranges.erase(best);
+
+        const vk::DeviceSize aligned = align_up(range_offset, alignment);
+        if (aligned > range_offset) block.free_ranges.emplace(range_offset, aligned - range_offset);
+        if (const vk::DeviceSize tail = range_offset + range_len - (aligned + size); tail > 0) block.free_ranges.emplace(aligned + size, tail);
+
+        block.used += size;
+        ++block.allocation_count;
+        return aligned;
+    }
+
+    void free_range(Block& block, const vk::DeviceSize offset, const vk::DeviceSize size) {
+        auto [it, inserted] = block.free_ranges.emplace(offset, size);
+        if (!inserted) return;
+
+        if (const auto next = std::next(it); next != block.free_ranges.end() && it->first + it->second == next->first) {
+            it->second += next->second;
+            block.free_ranges.erase(next);
+        }
+        if (it != block.free_ranges.begin()) {
+            if (const auto prev = std::prev(it); prev->first + prev->second == it->first) {
+                prev->second += it->second;
+                block.free_ranges.erase(it);
+            }
+        }
+
+        block.used -= size;
+        --block.allocation_count;
+    }
+
+    [[nodiscard]] std::optional<vk::DeviceSize> reserve_in_ring(vk::memory::StagingRing& ring, const vk::DeviceSize size, const vk::DeviceSize alignment) {
+        // Only rewind once nothing is in flight: a retiring batch, even an empty one, sets tail to
+        // its recorded end, which would point past a rewound head.
+        if (ring.used == 0 && ring.in_flight.empty()) {
+            ring.head = 0;
+            ring.tail = 0;
+        }
+        if (ring.used > 0 && ring.head == ring.tail) return std::nullopt;
+
+        vk::DeviceSize start = align_up(ring.head, alignment);
+        vk::DeviceSize taken = 0;
+
+        if (ring.head >= ring.tail) {
+            if (start + size <= ring.capacity) {
+                taken = start + size - ring.head;
+            } else if (size <= ring.tail) {
+                start = 0;
+                taken = ring.capacity - ring.head + size;
+            } else {
+                return std::nullopt;
+            }
+        } else {
+            if (start + size > ring.tail) return std::nullopt;
+            taken = start + size - ring.head;
+        }
+
+        ring.head = start + size;
+        ring.used += taken;
+        ring.open_bytes += taken;
+        return start;
+    }
+
+    [[nodiscard]] bool has_other_empty_block(const vk::memory::AllocatorState& s, const Block& self) {
+        return std::ranges::any_of(s.blocks, [&](const auto& b) { return b && b.get() != &self && !b->dedicated && b->allocation_count == 0 && b->memory_type == self.memory_type && b->kind == self.kind; });
+    }
+} // namespace
+
+vk::memory::Allocation::~Allocation() {
+    release(*this);
+}
+vk::memory::Allocation::Allocation(Allocation&& other) noexcept
+    : memory(std::exchange(other.memory, {})), offset(std::exchange(other.offset, 0)), size(std::exchange(other.size, 0)), memory_type(std::exchange(other.memory_type, 0)), properties(std::exchange(other.properties, {})), mapped(std::exchange(other.mapped, nullptr)), owner(std::move(other.owner)), block(std::exchange(other.block, 0)), tag(std::exchange(other.tag, 0)) {}
+vk::memory::Allocation& vk::memory::Allocation::operator=(Allocation&& other) noexcept {
+    if (this != &other) {
+        release(*this);
+        memory      = std::exchange(other.memory, {});
+        offset      = std::exchange(other.offset, 0);
+        size        = std::exchange(other.size, 0);
+        memory_type = std::exchange(other.memory_type, 0);
+        properties  = std::exchange(other.properties, {});
+        mapped      = std::exchange(other.mapped, nullptr);
+        owner       = std::move(other.owner);
+        block       = std::exchange(other.block, 0);
+        tag         = std::exchange(other.tag, 0);
+    }
+    return *this;
+}
+
 uint32_t vk::memory::find_memory_type(const raii::PhysicalDevice& physical_device, const uint32_t type_bits, const MemoryPropertyFlags required) {
-    const auto mem = physical_device.getMemoryProperties();
-    for (uint32_t i = 0; i < mem.memoryTypeCount; ++i) {
-        const bool type_ok = (type_bits & 1u << i) != 0;
-        if (const bool props_ok = (mem.memoryTypes[i].propertyFlags & required) == required; type_ok && props_ok) return i;
+    return find_memory_type_index(physical_device.getMemoryProperties(), type_bits, required);
+}
+vk::memory::Allocator vk::memory::create_allocator(const raii::PhysicalDevice& physical_device, const AllocatorDesc& desc) {
+    auto state                      = std::make_shared<AllocatorState>();
+    const auto limits               = physical_device.getProperties().limits;
+    state->desc                     = desc;
+    state->properties               = physical_device.getMemoryProperties();
+    state->non_coherent_atom        = std::max<DeviceSize>(limits.nonCoherentAtomSize, 1);
+    state->buffer_image_granularity = std::max<DeviceSize>(limits.bufferImageGranularity, 1);
+    return Allocator{.state = std::move(state)};
+}
+vk::memory::Allocation vk::memory::allocate(const Allocator& allocator, const raii::Device& device, const MemoryRequirements& requirements, const MemoryPropertyFlags required, ResourceKind kind, const MemoryPropertyFlags preferred) {
+    if (!allocator.state) throw std::runtime_error("vk.memory: allocator is not initialized");
+    auto& s = *allocator.state;
+
+    const uint32_t memory_type = find_memory_type_index(s.properties, requirements.memoryTypeBits, required, preferred);
+    const auto type_flags      = s.properties.memoryTypes[memory_type].propertyFlags;
+
+    DeviceSize alignment = std::max<DeviceSize>(requirements.alignment, 1);
+    DeviceSize size      = requirements.size;
+
+    // Keep non-coherent allocations on their own atoms so flushes never touch a neighbour.
+    if ((type_flags & MemoryPropertyFlagBits::eHostVisible) && !(type_flags & MemoryPropertyFlagBits::eHostCoherent)) {
+        alignment = std::max(alignment, s.non_coherent_atom);
+        size      = align_up(size, s.non_coherent_atom);
+    }
+    if (s.buffer_image_granularity <= 1) kind = ResourceKind::Linear;
+
+    std::scoped_lock lock{s.mutex};
+
+    const DeviceSize block_size = preferred_block_size(s, memory_type);
+
+    std::optional<uint32_t> block_index;
+    std::optional<DeviceSize> offset;
+
+    if (size > block_size / 2) {
+        block_index = create_block(s, device, memory_type, size, kind, true);
+        offset      = suballocate(*s.blocks[*block_index], size, alignment);
+    } else {
+        for (uint32_t i = 0; i < s.blocks.size() && !offset; ++i) {
+            auto& b = s.blocks[i];
+            if (!b || b->dedicated || b->memory_type != memory_type || b->kind != kind) continue;
+            if ((offset = suballocate(*b, size, alignment))) block_index = i;
+        }
+        if (!offset) {
+            block_index = create_block(s, device, memory_type, block_size, kind, false);
+            offset      = suballocate(*s.blocks[*block_index], size, alignment);
+        }
+    }
+    if (!offset) throw std::runtime_error("vk.memory: sub-allocation failed");
+
+    const auto& block = *s.blocks[*block_index];
+    ++s.tags[0].allocation_count;
+    s.tags[0].bytes += size;
+
+    Allocation out{};
+    out.memory      = *block.memory;
+    out.offset      = *offset;
+    out.size        = size;
+    out.memory_type = memory_type;
+    out.properties  = type_flags;
+    out.mapped      = block.mapped ? block.mapped + *offset : nullptr;
+    out.owner       = allocator.state;
+    out.block       = *block_index;
+    return out;
+}
+vk::memory::Allocation vk::memory::allocate_for_buffer(const Allocator& allocator, const raii::Device& device, const raii::Buffer& buffer, const MemoryPropertyFlags required, const MemoryPropertyFlags preferred) {
+    Allocation out = allocate(allocator, device, buffer.getMemoryRequirements(), required, ResourceKind::Linear, preferred);
+    buffer.bindMemory(out.memory, out.offset);
+    return out;
+}
+vk::memory::Allocation vk::memory::allocate_for_image(const Allocator& allocator, const raii::Device& device, const raii::Image& image, const MemoryPropertyFlags required, const MemoryPropertyFlags preferred) {
+    Allocation out = allocate(allocator, device, image.getMemoryRequirements(), required, ResourceKind::Optimal, preferred);
+    image.bindMemory(out.memory, out.offset);
+    return out;
+}
+void vk::memory::release(Allocation& allocation) noexcept {
+    if (!allocation.owner) return;
+
+    {
+        auto& s = *allocation.owner;
+        std::scoped_lock lock{s.mutex};
+
+        auto& block = s.blocks.at(allocation.block);
+        free_range(*block, allocation.offset, allocation.size);
+
+        auto& tag = s.tags.at(allocation.tag);
+        --tag.allocation_count;
+        tag.bytes -= allocation.size;
+
+        if (block->allocation_count == 0) {
+            if (block->dedicated || !s.desc.keep_empty_block || has_other_empty_block(s, *block)) block.reset();
+        }
     }
-    throw std::runtime_error("No suitable memory type");
+
+    allocation.owner.reset();
+    allocation.memory      = DeviceMemory{};
+    allocation.offset      = 0;
+    allocation.size        = 0;
+    allocation.memory_type = 0;
+    allocation.mapped      = nullptr;
+    allocation.block       = 0;
+    allocation.tag         = 0;
 }
-vk::memory::Buffer vk::memory::create_buffer(const raii::PhysicalDevice& physical_device, const raii::Device& device, const DeviceSize size, const BufferUsageFlags usage, const MemoryPropertyFlags mem_props) {
+vk::memory::AllocatorStats vk::memory::query_stats(const Allocator& allocator) {
+    AllocatorStats out{};
+    if (!allocator.state) return out;
+
+    auto& s = *allocator.state;
+    std::scoped_lock lock{s.mutex};
+
+    out.types.resize(s.properties.memoryTypeCount);
+    for (uint32_t i = 0; i < s.properties.memoryTypeCount; ++i) {
+        out.types[i].memory_type = i;
+        out.types[i].heap        = s.properties.memoryTypes[i].heapIndex;
+    }
+
+    for (const auto& b : s.blocks) {
+        if (!b) continue;
+        auto& t = out.types[b->memory_type];
+        ++t.block_count;
+        if (b->dedicated) ++t.dedicated_count;
+        t.allocation_count += b->allocation_count;
+        t.reserved_bytes += b->size;
+        t.used_bytes += b->used;
+        for (const auto& [offset, len] : b->free_ranges) {
+            t.free_bytes += len;
+            t.largest_free_range = std::max(t.largest_free_range, len);
+            ++t.free_range_count;
+        }
+    }
+
+    DeviceSize free_total   = 0;
+    DeviceSize largest_free = 0;
+    for (auto& t : out.types) {
+        if (t.free_bytes > 0) t.fragmentation = 1.0f - static_cast<float>(t.largest_free_range) / static_cast<float>(t.free_bytes);
+        out.block_count += t.block_count;
+        out.allocation_count += t.allocation_count;
+        out.reserved_bytes += t.reserved_bytes;
+        out.used_bytes += t.used_bytes;
+        free_total += t.free_bytes;
+        largest_free = std::max(largest_free, t.largest_free_range);
+    }
+    if (free_total > 0) out.fragmentation = 1.0f - static_cast<float>(largest_free) / static_cast<float>(free_total);
+
+    return out;
+}
+uint32_t vk::memory::register_tag(const Allocator& allocator, const std::string_view name) {
+    if (!allocator.state) throw std::runtime_error("vk.memory: allocator is not initialized");
+    auto& s = *allocator.state;
+    std::scoped_lock lock{s.mutex};
+
+    if (const auto it = std::ranges::find(s.tags, name, &AllocatorState::TagCounters::name); it != s.tags.end()) {
+        return static_cast<uint32_t>(std::distance(s.tags.begin(), it));
+    }
+    s.tags.push_back(AllocatorState::TagCounters{.name = std::string{name}});
+    return static_cast<uint32_t>(s.tags.size() - 1);
+}
+void vk::memory::set_tag(Allocation& allocation, const uint32_t tag) {
+    if (!allocation.owner) return;
+    auto& s = *allocation.owner;
+    std::scoped_lock lock{s.mutex};
+
+    if (tag >= s.tags.size()) throw std::runtime_error("vk.memory: unknown allocation tag");
+    auto& from = s.tags[allocation.tag];
+    auto& to   = s.tags[tag];
+    --from.allocation_count;
+    from.bytes -= allocation.size;
+    ++to.allocation_count;
+    to.bytes += allocation.size;
+    allocation.tag = tag;
+}
+vk::memory::MemoryTelemetry vk::memory::query_telemetry(const Allocator& allocator, const raii::PhysicalDevice& physical_device) {
+    MemoryTelemetry out{};
+    out.allocator = query_stats(allocator);
+    out.host      = query_host_allocations();
+
+    const bool use_budget = allocator.state && allocator.state->desc.use_memory_budget;
+
+    PhysicalDeviceMemoryProperties props{};
+    PhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+    if (use_budget) {
+        const auto chain = physical_device.getMemoryProperties2<PhysicalDeviceMemoryProperties2, PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        props            = chain.get<PhysicalDeviceMemoryProperties2>().memoryProperties;
+        budget           = chain.get<PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    } else {
+        props = physical_device.getMemoryProperties();
+    }
+    out.budget_available = use_budget;
+
+    out.heaps.resize(props.memoryHeapCount);
+    for (uint32_t i = 0; i < props.memoryHeapCount; ++i) {
+        auto& h        = out.heaps[i];
+        h.heap         = i;
+        h.device_local = static_cast<bool>(props.memoryHeaps[i].flags & MemoryHeapFlagBits::eDeviceLocal);
+        h.size         = props.memoryHeaps[i].size;
+    }
+    for (const auto& t : out.allocator.types) {
+        if (t.heap >= out.heaps.size()) continue;
+        auto& h = out.heaps[t.heap];
+        h.reserved_bytes += t.reserved_bytes;
+        h.used_bytes += t.used_bytes;
+        h.allocation_count += t.allocation_count;
+    }
+    for (auto& h : out.heaps) {
+        h.budget = use_budget ? budget.heapBudget[h.heap] : h.size;
+        h.usage  = use_budget ? budget.heapUsage[h.heap] : h.reserved_bytes;
+        if (h.budget > 0) out.max_heap_pressure = std::max(out.max_heap_pressure, static_cast<float>(h.usage) / static_cast<float>(h.budget));
+    }
+
+    if (allocator.state) {
+        auto& s = *allocator.state;
+        std::scoped_lock lock{s.mutex};
+        out.tags.reserve(s.tags.size());
+        for (const auto& t : s.tags) out.tags.push_back(TagStats{.name = t.name, .allocation_count = t.allocation_count, .bytes = t.bytes});
+    }
+
+    return out;
+}
+const vk::AllocationCallbacks* vk::memory::host_allocation_callbacks() {
+    return &g_host_callbacks;
+}
+vk::memory::HostAllocationStats vk::memory::query_host_allocations() {
+    return HostAllocationStats{
+        .live_allocations  = g_host.live_allocations.load(std::memory_order_relaxed),
+        .live_bytes        = g_host.live_bytes.load(std::memory_order_relaxed),
+        .peak_bytes        = g_host.peak_bytes.load(std::memory_order_relaxed),
+        .total_allocations = g_host.total_allocations.load(std::memory_order_relaxed),
+        .internal_bytes    = g_host.internal_bytes.load(std::memory_order_relaxed),
+    };
+}
+vk::memory::StagingRing vk::memory::create_staging_ring(const Allocator& allocator, const raii::Device& device, const DeviceSize capacity) {
+    if (capacity == 0) throw std::runtime_error("vk.memory: staging ring capacity must be > 0");
+
+    StagingRing out{};
+    out.buffer   = create_buffer(allocator, device, capacity, BufferUsageFlagBits::eTransferSrc, MemoryPropertyFlagBits::eHostVisible | MemoryPropertyFlagBits::eHostCoherent);
+    set_tag(out.buffer.allocation, register_tag(allocator, "staging"));
+    out.capacity = capacity;
+
+    const SemaphoreTypeCreateInfo type_ci{
+        .semaphoreType = SemaphoreType::eTimeline,
+        .initialValue  = 0,
+    };
+    out.timeline = raii::Semaphore{device, SemaphoreCreateInfo{.pNext = &type_ci}};
+    return out;
+}
+void vk::memory::recycle(StagingRing& ring) {
+    if (ring.in_flight.empty()) return;
+
+    const uint64_t completed = ring.timeline.getCounterValue();
+    while (!ring.in_flight.empty() && ring.in_flight.front().value <= completed) {
+        const auto& batch = ring.in_flight.front();
+        ring.tail         = batch.end;
+        ring.used -= batch.bytes;
+        ring.in_flight.pop_front();
+    }
+}
+std::optional<vk::memory::StagingSlice> vk::memory::try_stage(StagingRing& ring, const std::span<const std::byte> bytes, const DeviceSize alignment) {
+    const DeviceSize size = bytes.size_bytes();
+    if (size > ring.capacity) throw std::runtime_error("vk.memory: upload larger than staging ring");
+
+    recycle(ring);
+    const auto offset = reserve_in_ring(ring, size, alignment);
+    if (!offset) return std::nullopt;
+
+    StagingSlice out{
+        .buffer = *ring.buffer.buffer,
+        .offset = *offset,
+        .size   = size,
+        .mapped = ring.buffer.allocation.mapped + *offset,
+    };
+    std::memcpy(out.mapped, bytes.data(), size);
+    return out;
+}
+vk::memory::StagingSlice vk::memory::stage(StagingRing& ring, const raii::Device& device, const std::span<const std::byte> bytes, const DeviceSize alignment) {
+    while (true) {
+        if (auto slice = try_stage(ring, bytes, alignment)) return *slice;
+        if (ring.in_flight.empty()) throw std::runtime_error("vk.memory: staging ring exhausted by an unsubmitted batch");
+        wait_staged(ring, device, ring.in_flight.front().value);
+    }
+}
+uint64_t vk::memory::close_batch(StagingRing& ring) {
+    const uint64_t value = ++ring.submitted;
+    ring.in_flight.push_back(StagingRing::Batch{
+        .end   = ring.head,
+        .bytes = ring.open_bytes,
+        .value = value,
+    });
+    ring.open_bytes = 0;
+    return value;
+}
+uint64_t vk::memory::submit_staged(StagingRing& ring, const raii::Queue& queue, const raii::CommandBuffer& cmd) {
+    const uint64_t value = close_batch(ring);
+
+    const CommandBufferSubmitInfo cbsi{.commandBuffer = *cmd};
+    const SemaphoreSubmitInfo signal{
+        .semaphore = *ring.timeline,
+        .value     = value,
+        .stageMask = PipelineStageFlagBits2::eAllCommands,
+    };
+    const SubmitInfo2 submit{
+        .commandBufferInfoCount   = 1,
+        .pCommandBufferInfos      = &cbsi,
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos    = &signal,
+    };
+    queue.submit2(submit);
+    return value;
+}
+void vk::memory::wait_staged(const StagingRing& ring, const raii::Device& device, const uint64_t value) {
+    const Semaphore semaphore = *ring.timeline;
+    const SemaphoreWaitInfo wi{
+        .semaphoreCount = 1,
+        .pSemaphores    = &semaphore,
+        .pValues        = &value,
+    };
+    (void) device.waitSemaphores(wi, UINT64_MAX);
+}
+vk::memory::TransferBatcher vk::memory::create_transfer_batcher(const raii::Device& device, const uint32_t queue_family, const uint32_t dst_queue_family) {
+    TransferBatcher out{};
+    out.queue_family     = queue_family;
+    out.dst_queue_family = dst_queue_family == VK_QUEUE_FAMILY_IGNORED ? queue_family : dst_queue_family;
+
+    const CommandPoolCreateInfo ci{
+        .flags            = CommandPoolCreateFlagBits::eResetCommandBuffer | CommandPoolCreateFlagBits::eTransient,
+        .queueFamilyIndex = queue_family,
+    };
+    out.command_pool = raii::CommandPool{device, ci};
+    return out;
+}
+const vk::raii::CommandBuffer& vk::memory::batch_cmd(TransferBatcher& batcher, const raii::Device& device) {
+    if (batcher.recording_open) return batcher.recording;
+
+    if (!batcher.free_cmds.empty()) {
+        batcher.recording = std::move(batcher.free_cmds.back());
+        batcher.free_cmds.pop_back();
+        batcher.recording.reset();
+    } else {
+        const CommandBufferAllocateInfo ai{
+            .commandPool        = *batcher.command_pool,
+            .level              = CommandBufferLevel::ePrimary,
+            .commandBufferCount = 1,
+        };
+        batcher.recording = std::move(device.allocateCommandBuffers(ai).front());
+    }
+
+    batcher.recording.begin(CommandBufferBeginInfo{.flags = CommandBufferUsageFlagBits::eOneTimeSubmit});
+    batcher.recording_open = true;
+    batcher.recorded_ops   = 0;
+    return batcher.recording;
+}
+vk::memory::StagingSlice vk::memory::stage_for_batch(TransferBatcher& batcher, StagingRing& ring, const raii::Device& device, const raii::Queue& queue, const std::span<const std::byte> bytes, const DeviceSize alignment) {
+    if (auto slice = try_stage(ring, bytes, alignment)) return *slice;
+
+    // The ring is full: submit what has been recorded so far so its regions can retire.
+    // Callers must fetch batch_cmd() after staging, since this may start a new command buffer.
+    if (batcher.recording_open) (void) flush(batcher, ring, queue);
+    return stage(ring, device, bytes, alignment);
+}
+void vk::memory::enqueue_buffer_upload(TransferBatcher& batcher, StagingRing& ring, const raii::Device& device, const raii::Queue& queue, const std::span<const std::byte> bytes, const Buffer& dst, const DeviceSize dst_offset) {
+    const DeviceSize size = bytes.size_bytes();
+    if (dst_offset + size > dst.size) throw std::runtime_error("vk.memory: enqueue_buffer_upload overflow");
+
+    // Uploads larger than half the ring are split so one chunk can be copied while the next is staged.
+    const DeviceSize max_chunk = std::max<DeviceSize>(ring.capacity / 2, 1);
+
+    for (DeviceSize offset = 0; offset < size;) {
+        const DeviceSize n = std::min(max_chunk, size - offset);
+        const auto slice   = stage_for_batch(batcher, ring, device, queue, bytes.subspan(static_cast<size_t>(offset), static_cast<size_t>(n)), 4);
+
+        const BufferCopy region{.srcOffset = slice.offset, .dstOffset = dst_offset + offset, .size = n};
+        batch_cmd(batcher, device).copyBuffer(slice.buffer, *dst.buffer, region);
+        ++batcher.recorded_ops;
+        offset += n;
+    }
+
+    if (batcher.queue_family != batcher.dst_queue_family && size > 0) {
+        batcher.releases.push_back(BufferMemoryBarrier2{
+            .srcStageMask        = PipelineStageFlagBits2::eCopy,
+            .srcAccessMask       = AccessFlagBits2::eTransferWrite,
+            .dstStageMask        = PipelineStageFlagBits2::eNone,
+            .dstAccessMask       = AccessFlagBits2::eNone,
+            .srcQueueFamilyIndex = batcher.queue_family,
+            .dstQueueFamilyIndex = batcher.dst_queue_family,
+            .buffer              = *dst.buffer,
+            .offset              = dst_offset,
+            .size                = size,
+        });
+    }
+}
+void vk::memory::enqueue_buffer_copy(TransferBatcher& batcher, const raii::Device& device, const Buffer& src, const Buffer& dst, const std::span<const BufferCopy> regions) {
+    if (regions.empty()) return;
+    batch_cmd(batcher, device).copyBuffer(*src.buffer, *dst.buffer, regions);
+    ++batcher.recorded_ops;
+}
+vk::memory::TransferTicket vk::memory::flush(TransferBatcher& batcher, StagingRing& ring, const raii::Queue& queue) {
+    if (batcher.recording_open) {
+        if (!batcher.releases.empty()) {
+            batcher.recording.pipelineBarrier2(DependencyInfo{
+                .bufferMemoryBarrierCount = static_cast<uint32_t>(batcher.releases.size()),
+                .pBufferMemoryBarriers    = batcher.releases.data(),
+            });
+        }
+
+        batcher.recording.end();
+        const uint64_t value = submit_staged(ring, queue, batcher.recording);
+
+        for (auto b : batcher.releases) {
+            b.srcStageMask  = PipelineStageFlagBits2::eNone;
+            b.srcAccessMask = AccessFlagBits2::eNone;
+            batcher.acquires.push_back(b);
+        }
+        if (!batcher.releases.empty()) batcher.acquire_ticket = TransferTicket{.semaphore = *ring.timeline, .value = value};
+        batcher.releases.clear();
+
+        batcher.in_flight.push_back(TransferBatcher::Pending{
+            .cmd   = std::move(batcher.recording),
+            .value = value,
+        });
+        batcher.recording      = raii::CommandBuffer{nullptr};
+        batcher.recording_open = false;
+        batcher.recorded_ops   = 0;
+    }
+
+    const uint64_t completed = ring.timeline.getCounterValue();
+    while (!batcher.in_flight.empty() && batcher.in_flight.front().value <= completed) {
+        batcher.free_cmds.push_back(std::move(batcher.in_flight.front().cmd));
+        batcher.in_flight.pop_front();
+    }
+
+    return TransferTicket{
+        .semaphore = *ring.timeline,
+        .value     = ring.submitted,
+    };
+}
+vk::memory::TransferTicket vk::memory::record_acquires(TransferBatcher& batcher, const raii::CommandBuffer& cmd, const PipelineStageFlags2 dst_stage, const AccessFlags2 dst_access) {
+    if (batcher.acquires.empty()) return {};
+
+    for (auto& b : batcher.acquires) {
+        b.dstStageMask  = dst_stage;
+        b.dstAccessMask = dst_access;
+    }
+    cmd.pipelineBarrier2(DependencyInfo{
+        .bufferMemoryBarrierCount = static_cast<uint32_t>(batcher.acquires.size()),
+        .pBufferMemoryBarriers    = batcher.acquires.data(),
+    });
+    batcher.acquires.clear();
+
+    // The submission containing `cmd` must wait on this ticket so the acquire follows the release.
+    return std::exchange(batcher.acquire_ticket, TransferTicket{});
+}
+bool vk::memory::is_complete(const raii::Device& device, const TransferTicket& ticket) {
+    if (!ticket.semaphore) return true;
+    // The RAII device only exposes the counter through raii::Semaphore, so go through the dispatcher.
+    uint64_t value = 0;
+    const auto r   = static_cast<Result>(device.getDispatcher()->vkGetSemaphoreCounterValue(*device, static_cast<VkSemaphore>(ticket.semaphore), &value));
+    if (r != Result::eSuccess) throw std::runtime_error("vk.memory: vkGetSemaphoreCounterValue failed");
+    return value >= ticket.value;
+}
+void vk::memory::wait_ticket(const raii::Device& device, const TransferTicket& ticket) {
+    if (!ticket.semaphore) return;
+    const SemaphoreWaitInfo wi{
+        .semaphoreCount = 1,
+        .pSemaphores    = &ticket.semaphore,
+        .pValues        = &ticket.value,
+    };
+    (void) device.waitSemaphores(wi, UINT64_MAX);
+}
+vk::SemaphoreSubmitInfo vk::memory::wait_info(const TransferTicket& ticket, const PipelineStageFlags2 stages) {
+    return SemaphoreSubmitInfo{
+        .semaphore = ticket.semaphore,
+        .value     = ticket.value,
+        .stageMask = stages,
+    };
+}
+vk::memory::Buffer vk::memory::create_buffer(const Allocator& allocator, const raii::Device& device, const DeviceSize size, const BufferUsageFlags usage, const MemoryPropertyFlags mem_props) {
     Buffer out{};
     out.size = size;
 
@@ -20,25 +794,67 @@ vk::memory::Buffer vk::memory::create_buffer(const raii::PhysicalDevice& physica
         .usage       = usage,
         .sharingMode = SharingMode::eExclusive,
     };
-    out.buffer = raii::Buffer{device, bci};
+    out.buffer     = raii::Buffer{device, bci};
+    out.allocation = allocate_for_buffer(allocator, device, out.buffer, mem_props);
+    return out;
+}
+void vk::memory::write_mapped(const Buffer& dst, const std::span<const std::byte> bytes) {
+    if (bytes.size_bytes() > static_cast<size_t>(dst.size)) throw std::runtime_error("write_mapped overflow");
+    if (!dst.allocation.mapped) throw std::runtime_error("write_mapped: buffer memory is not host visible");
+    if (!(dst.allocation.properties & MemoryPropertyFlagBits::eHostCoherent)) throw std::runtime_error("write_mapped: buffer memory is not host coherent, use a MappedBuffer");
+    std::memcpy(dst.allocation.mapped, bytes.data(), bytes.size_bytes());
+}
+vk::memory::MappedBuffer vk::memory::create_mapped_buffer(const Allocator& allocator, const raii::Device& device, const DeviceSize size, const BufferUsageFlags usage, const HostAccess access) {
+    if (!allocator.state) throw std::runtime_error("vk.memory: allocator is not initialized");
+
+    const MemoryPropertyFlags preferred = access == HostAccess::Readback ? MemoryPropertyFlagBits::eHostCached : MemoryPropertyFlagBits::eHostCoherent;
 
-    const auto req          = out.buffer.getMemoryRequirements();
-    const uint32_t mem_type = find_memory_type(physical_device, req.memoryTypeBits, mem_props);
+    MappedBuffer out{};
+    out.buffer.size = size;
 
-    const MemoryAllocateInfo mai{
-        .allocationSize  = req.size,
-        .memoryTypeIndex = mem_type,
+    const BufferCreateInfo bci{
+        .size        = size,
+        .usage       = usage,
+        .sharingMode = SharingMode::eExclusive,
     };
-    out.memory = raii::DeviceMemory{device, mai};
+    out.buffer.buffer     = raii::Buffer{device, bci};
+    out.buffer.allocation = allocate_for_buffer(allocator, device, out.buffer.buffer, MemoryPropertyFlagBits::eHostVisible, preferred);
 
-    out.buffer.bindMemory(*out.memory, 0);
+    out.mapped   = out.buffer.allocation.mapped;
+    out.coherent = static_cast<bool>(out.buffer.allocation.properties & MemoryPropertyFlagBits::eHostCoherent);
+    out.atom     = allocator.state->non_coherent_atom;
     return out;
 }
-void vk::memory::write_mapped(const Buffer& dst, const std::span<const std::byte> bytes) {
-    if (bytes.size_bytes() > static_cast<size_t>(dst.size)) throw std::runtime_error("write_mapped overflow");
-    void* ptr = dst.memory.mapMemory(0, dst.size);
-    std::memcpy(ptr, bytes.data(), bytes.size_bytes());
-    dst.memory.unmapMemory();
+void vk::memory::mark_dirty(MappedBuffer& dst, const DeviceSize offset, const DeviceSize size) {
+    if (dst.coherent || size == 0) return;
+    if (!dst.dirty.empty() && dst.dirty.back().second == offset) {
+        dst.dirty.back().second = offset + size;
+        return;
+    }
+    dst.dirty.emplace_back(offset, offset + size);
+}
+void vk::memory::write(MappedBuffer& dst, const DeviceSize offset, const std::span<const std::byte> bytes) {
+    if (offset + bytes.size_bytes() > dst.buffer.size) throw std::runtime_error("vk.memory: write out of range");
+    std::memcpy(dst.mapped + offset, bytes.data(), bytes.size_bytes());
+    mark_dirty(dst, offset, bytes.size_bytes());
+}
+void vk::memory::flush_mapped(const raii::Device& device, MappedBuffer& dst) {
+    MappedBuffer* const one[] = {&dst};
+    flush_mapped(device, one);
+}
+void vk::memory::flush_mapped(const raii::Device& device, const std::span<MappedBuffer* const> buffers) {
+    std::vector<MappedMemoryRange> ranges;
+    for (const auto* b : buffers) append_dirty_ranges(*b, ranges);
+    if (!ranges.empty()) device.flushMappedMemoryRanges(ranges);
+    for (auto* b : buffers) b->dirty.clear();
+}
+void vk::memory::invalidate_mapped(const raii::Device& device, const MappedBuffer& src, const DeviceSize offset, const DeviceSize size) {
+    if (src.coherent) return;
+
+    const auto& a          = src.buffer.allocation;
+    const DeviceSize end   = size == WholeSize ? a.size : std::min(align_up(offset + size, src.atom), a.size);
+    const DeviceSize begin = align_down(offset, src.atom);
+    device.invalidateMappedMemoryRanges(MappedMemoryRange{.memory = a.memory, .offset = a.offset + begin, .size = end - begin});
 }
 void vk::memory::copy_buffer_immediate(const raii::Device& device, const raii::CommandPool& command_pool, const raii::Queue& queue, const Buffer& src, const Buffer& dst, const DeviceSize size) {
     const CommandBufferAllocateInfo ai{
@@ -64,16 +880,18 @@ void vk::memory::copy_buffer_immediate(const raii::Device& device, const raii::C
     raii::Fence fence{device, FenceCreateInfo{}};
     queue.submit2({submit}, *fence);
     (void) device.waitForFences(*fence, true, UINT64_MAX);
-    queue.waitIdle();
 }
-vk::memory::Buffer vk::memory::upload_to_device_local_buffer(const raii::PhysicalDevice& physical_device, const raii::Device& device, const raii::CommandPool& command_pool, const raii::Queue& queue, const std::span<const std::byte> bytes, const BufferUsageFlags final_usage) {
-    const DeviceSize size = bytes.size_bytes();
-
-    const Buffer staging = create_buffer(physical_device, device, size, BufferUsageFlagBits::eTransferSrc, MemoryPropertyFlagBits::eHostVisible | MemoryPropertyFlagBits::eHostCoherent);
-    write_mapped(staging, bytes);
-
-    Buffer gpu = create_buffer(physical_device, device, size, final_usage | BufferUsageFlagBits::eTransferDst, MemoryPropertyFlagBits::eDeviceLocal);
-
-    copy_buffer_immediate(device, command_pool, queue, staging, gpu, size);
+vk::memory::Buffer vk::memory::enqueue_upload_to_device_local_buffer(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, const std::span<const std::byte> bytes, const BufferUsageFlags final_usage) {
+    Buffer gpu = create_buffer(allocator, device, bytes.size_bytes(), final_usage | BufferUsageFlagBits::eTransferDst, MemoryPropertyFlagBits::eDeviceLocal);
+    enqueue_buffer_upload(batcher, staging, device, queue, bytes, gpu);
     return gpu;
 }
+vk::memory::Buffer vk::memory::upload_to_device_local_buffer(const Allocator& allocator, const raii::Device& device, const raii::Queue& queue, StagingRing& staging, TransferBatcher& batcher, const std::span<const std::byte> bytes, const BufferUsageFlags final_usage) {
+    Buffer gpu = enqueue_upload_to_device_local_buffer(allocator, device, queue, staging, batcher, bytes, final_usage);
+    wait_ticket(device, flush(batcher, staging, queue));
+    return gpu;
+}
+void vk::memory::bind_mesh(const raii::CommandBuffer& cmd, const Buffer& buffer, const MeshRange& range) {
+    cmd.bindVertexBuffers(0, *buffer.buffer, range.vertex_offset);
+    cmd.bindIndexBuffer(*buffer.buffer, range.index_offset, IndexType::eUint32);
+}
@@ -3,6 +3,526 @@ module;
 module vk.pipeline;
 import std;
 
+namespace {
+
+    // Prefix of the on-disk cache file; the driver's own VkPipelineCacheHeaderVersionOne follows
+    // inside the payload.
+    struct CacheFileHeader {
+        std::array<char, 4> magic{'V', 'V', 'P', 'C'};
+        std::uint32_t version{1};
+        std::uint32_t vendor_id{0};
+        std::uint32_t device_id{0};
+        std::uint32_t driver_version{0};
+        std::array<std::uint8_t, vk::UuidSize> uuid{};
+        std::uint32_t reserved{0}; // explicit, so no uninitialized padding reaches the file
+        std::uint64_t payload_size{0};
+        std::uint64_t payload_hash{0};
+    };
+
+    [[nodiscard]] std::uint64_t fnv1a(const std::span<const std::byte> bytes) {
+        std::uint64_t h = 0xCBF2'9CE4'8422'2325ull;
+        for (const std::byte b : bytes) {
+            h ^= static_cast<std::uint64_t>(b);
+            h *= 0x0000'0100'0000'01B3ull;
+        }
+        return h;
+    }
+
+    [[nodiscard]] CacheFileHeader expected_header(const vk::pipeline::PipelineCache& cache) {
+        CacheFileHeader h{};
+        h.vendor_id      = cache.vendor_id;
+        h.device_id      = cache.device_id;
+        h.driver_version = cache.driver_version;
+        h.uuid           = cache.uuid;
+        return h;
+    }
+
+    // Returns the payload when both the file header and the driver header match this device.
+    [[nodiscard]] std::vector<std::byte> read_cache_payload(const vk::pipeline::PipelineCache& cache) {
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(cache.path, ec)) return {};
+
+        std::vector<std::byte> file;
+        try {
+            file = vk::pipeline::read_file_bytes(cache.path.string());
+        } catch (const std::runtime_error&) {
+            return {};
+        }
+        if (file.size() < sizeof(CacheFileHeader)) return {};
+
+        CacheFileHeader h{};
+        std::memcpy(&h, file.data(), sizeof(h));
+        const CacheFileHeader want = expected_header(cache);
+        if (h.magic != want.magic || h.version != want.version) return {};
+        if (h.vendor_id != want.vendor_id || h.device_id != want.device_id || h.driver_version != want.driver_version || h.uuid != want.uuid) return {};
+
+        const std::span payload{file.data() + sizeof(h), file.size() - sizeof(h)};
+        if (payload.size() != h.payload_size || fnv1a(payload) != h.payload_hash) return {};
+
+        vk::PipelineCacheHeaderVersionOne vk_header{};
+        if (payload.size() < sizeof(vk_header)) return {};
+        std::memcpy(&vk_header, payload.data(), sizeof(vk_header));
+        if (vk_header.headerVersion != vk::PipelineCacheHeaderVersion::eOne || vk_header.vendorID != cache.vendor_id || vk_header.deviceID != cache.device_id) return {};
+        if (!std::ranges::equal(vk_header.pipelineCacheUUID, cache.uuid)) return {};
+
+        return {payload.begin(), payload.end()};
+    }
+
+    void hash_combine(std::uint64_t& seed, const std::uint64_t v) {
+        seed ^= v + 0x9E37'79B9'7F4A'7C15ull + (seed << 6) + (seed >> 2);
+    }
+
+    // Dynamic topology may only change within one of these classes.
+    [[nodiscard]] std::uint32_t topology_class(const vk::PrimitiveTopology topology) {
+        switch (topology) {
+        case vk::PrimitiveTopology::ePointList: return 0;
+        case vk::PrimitiveTopology::eLineList:
+        case vk::PrimitiveTopology::eLineStrip:
+        case vk::PrimitiveTopology::eLineListWithAdjacency:
+        case vk::PrimitiveTopology::eLineStripWithAdjacency: return 1;
+        case vk::PrimitiveTopology::ePatchList: return 3;
+        default: return 2;
+        }
+    }
+
+    void record_feedback(vk::pipeline::PipelineCache& cache, const vk::PipelineCreationFeedback& feedback) {
+        auto& st = cache.stats;
+        ++st.pipelines;
+        if (!(feedback.flags & vk::PipelineCreationFeedbackFlagBits::eValid)) return;
+        if (feedback.flags & vk::PipelineCreationFeedbackFlagBits::eApplicationPipelineCacheHit) ++st.hits;
+        else ++st.misses;
+        st.create_ms += static_cast<double>(feedback.duration) * 1e-6;
+    }
+
+} // namespace
+
+namespace vk::pipeline {
+    namespace {
+        // The subset of SPIR-V needed to reflect a module's interface.
+        namespace spirv {
+            constexpr std::uint32_t magic = 0x0723'0203u;
+
+            // Caps on values taken from the module, so a corrupt one throws instead of allocating or
+            // looping without bound. 64 is above any device's maxVertexInputAttributes.
+            constexpr std::uint32_t max_vertex_locations = 64;
+            constexpr std::uint32_t max_descriptor_count = 1u << 20;
+
+            enum Op : std::uint32_t {
+                OpName                         = 5,
+                OpEntryPoint                   = 15,
+                OpTypeBool                     = 20,
+                OpTypeInt                      = 21,
+                OpTypeFloat                    = 22,
+                OpTypeVector                   = 23,
+                OpTypeMatrix                   = 24,
+                OpTypeImage                    = 25,
+                OpTypeSampler                  = 26,
+                OpTypeSampledImage             = 27,
+                OpTypeArray                    = 28,
+                OpTypeRuntimeArray             = 29,
+                OpTypeStruct                   = 30,
+                OpTypePointer                  = 32,
+                OpConstant                     = 43,
+                OpSpecConstantTrue             = 48,
+                OpSpecConstantFalse            = 49,
+                OpSpecConstant                 = 50,
+                OpVariable                     = 59,
+                OpDecorate                     = 71,
+                OpMemberDecorate               = 72,
+                OpTypeAccelerationStructureKHR = 5341,
+            };
+
+            enum Decoration : std::uint32_t {
+                SpecId        = 1,
+                Block         = 2,
+                BufferBlock   = 3,
+                RowMajor      = 4,
+                ArrayStride   = 6,
+                MatrixStride  = 7,
+                BuiltIn       = 11,
+                Location      = 30,
+                Binding       = 33,
+                DescriptorSet = 34,
+                Offset        = 35,
+            };
+
+            enum StorageClass : std::uint32_t {
+                UniformConstant = 0,
+                Input           = 1,
+                Uniform         = 2,
+                PushConstant    = 9,
+                StorageBuffer   = 12,
+            };
+
+            constexpr std::uint32_t DimBuffer      = 5;
+            constexpr std::uint32_t DimSubpassData = 6;
+        } // namespace spirv
+
+        struct SpirvMember {
+            std::uint32_t offset{0};
+            std::uint32_t matrix_stride{0};
+            bool row_major{false};
+        };
+
+        // One entry per result id. Field meaning depends on the opcode, following the operand order
+        // of the defining instruction.
+        struct SpirvId {
+            std::uint32_t opcode{0};
+            std::uint32_t type{0}; // component, element, sampled or pointee type; result type of values
+            std::uint32_t length{0}; // scalar width, component/column count, array length id, image dim
+            std::uint32_t extra{0}; // int signedness, image Sampled operand, storage class
+            std::uint64_t value{0}; // constants
+            std::vector<std::uint32_t> members{};
+            std::vector<SpirvMember> member_layout{};
+            std::string name{};
+
+            std::optional<std::uint32_t> set{};
+            std::optional<std::uint32_t> binding{};
+            std::optional<std::uint32_t> location{};
+            std::optional<std::uint32_t> spec_id{};
+            std::uint32_t array_stride{0};
+            bool block{false};
+            bool buffer_block{false};
+            bool builtin{false};
+        };
+
+        struct SpirvEntry {
+            std::uint32_t model{0};
+            std::string name{};
+            std::vector<std::uint32_t> interface{};
+        };
+
+        struct SpirvModule {
+            std::uint32_t version{0};
+            std::vector<SpirvId> ids{};
+            std::vector<SpirvEntry> entries{};
+
+            [[nodiscard]] const SpirvId& at(const std::uint32_t id) const {
+                if (id >= ids.size()) throw std::runtime_error("vk.pipeline: malformed SPIR-V (id out of range)");
+                return ids[id];
+            }
+
+            // OpTypeArray lengths are OpConstant values of up to 64 bits.
+            [[nodiscard]] std::uint32_t array_length(const SpirvId& array, const std::uint64_t limit) const {
+                const std::uint64_t n = at(array.length).value;
+                if (n > limit) throw std::runtime_error(std::format("vk.pipeline: malformed SPIR-V (array length {} exceeds {})", n, limit));
+                return static_cast<std::uint32_t>(n);
+            }
+        };
+
+        [[nodiscard]] std::string read_string(const std::span<const std::uint32_t> words, std::size_t& at) {
+            std::string out;
+            for (; at < words.size(); ++at) {
+                for (std::uint32_t b = 0; b < 4; ++b) {
+                    const char c = static_cast<char>((words[at] >> (8 * b)) & 0xFFu);
+                    if (c == '\0') {
+                        ++at;
+                        return out;
+                    }
+                    out.push_back(c);
+                }
+            }
+            return out;
+        }
+
+        [[nodiscard]] SpirvModule parse_spirv(const std::span<const std::byte> spv) {
+            if (spv.size_bytes() % 4u != 0u || spv.size_bytes() < 20u) throw std::runtime_error("vk.pipeline: SPIR-V size must be a multiple of 4 and include the header");
+
+            std::vector<std::uint32_t> words(spv.size_bytes() / 4u);
+            std::memcpy(words.data(), spv.data(), spv.size_bytes());
+            if (words[0] != spirv::magic) throw std::runtime_error("vk.pipeline: not a SPIR-V module (bad magic)");
+
+            SpirvModule m{};
+            m.version = words[1];
+            // Every id below the bound needs its own defining instruction, so a bound larger than the
+            // module is corrupt.
+            if (words[3] > words.size()) throw std::runtime_error("vk.pipeline: malformed SPIR-V (id bound exceeds module size)");
+            m.ids.resize(words[3]);
+
+            const auto def = [&](const std::uint32_t id) -> SpirvId& {
+                if (id >= m.ids.size()) throw std::runtime_error("vk.pipeline: malformed SPIR-V (id out of range)");
+                return m.ids[id];
+            };
+
+            for (std::size_t i = 5; i < words.size();) {
+                const std::uint32_t count = words[i] >> 16;
+                const std::uint32_t op    = words[i] & 0xFFFFu;
+                if (count == 0 || i + count > words.size()) throw std::runtime_error("vk.pipeline: malformed SPIR-V (bad instruction length)");
+                const std::span<const std::uint32_t> in{words.data() + i, count};
+                i += count;
+
+                // Operand counts below are the minimum for each instruction; shorter ones are skipped.
+                const auto operands = [&](const std::size_t n) { return in.size() > n; };
+
+                switch (op) {
+                case spirv::OpName: {
+                    if (!operands(1)) break;
+                    std::size_t at = 2;
+                    def(in[1]).name = read_string(in, at);
+                    break;
+                }
+                case spirv::OpEntryPoint: {
+                    if (!operands(3)) break;
+                    SpirvEntry e{.model = in[1]};
+                    std::size_t at = 3;
+                    e.name         = read_string(in, at);
+                    e.interface.assign(in.begin() + static_cast<std::ptrdiff_t>(std::min(at, in.size())), in.end());
+                    m.entries.push_back(std::move(e));
+                    break;
+                }
+                case spirv::OpTypeBool:
+                case spirv::OpTypeSampler:
+                case spirv::OpTypeAccelerationStructureKHR:
+                    if (operands(1)) def(in[1]).opcode = op;
+                    break;
+                case spirv::OpTypeInt:
+                case spirv::OpTypeFloat: {
+                    if (!operands(2)) break;
+                    auto& t  = def(in[1]);
+                    t.opcode = op;
+                    t.length = in[2];
+                    t.extra  = operands(3) ? in[3] : 0u;
+                    break;
+                }
+                case spirv::OpTypeVector:
+                case spirv::OpTypeMatrix:
+                case spirv::OpTypeArray: {
+                    if (!operands(3)) break;
+                    auto& t  = def(in[1]);
+                    t.opcode = op;
+                    t.type   = in[2];
+                    t.length = in[3];
+                    break;
+                }
+                case spirv::OpTypeImage: {
+                    if (!operands(7)) break;
+                    auto& t  = def(in[1]);
+                    t.opcode = op;
+                    t.type   = in[2];
+                    t.length = in[3];
+                    t.extra  = in[7];
+                    break;
+                }
+                case spirv::OpTypeSampledImage:
+                case spirv::OpTypeRuntimeArray: {
+                    if (!operands(2)) break;
+                    auto& t  = def(in[1]);
+                    t.opcode = op;
+                    t.type   = in[2];
+                    break;
+                }
+                case spirv::OpTypeStruct: {
+                    if (!operands(1)) break;
+                    auto& t  = def(in[1]);
+                    t.opcode = op;
+                    t.members.assign(in.begin() + 2, in.end());
+                    t.member_layout.resize(std::max(t.member_layout.size(), t.members.size()));
+                    break;
+                }
+                case spirv::OpTypePointer: {
+                    if (!operands(3)) break;
+                    auto& t  = def(in[1]);
+                    t.opcode = op;
+                    t.extra  = in[2];
+                    t.type   = in[3];
+                    break;
+                }
+                case spirv::OpConstant:
+                case spirv::OpSpecConstant: {
+                    if (!operands(3)) break;
+                    auto& c  = def(in[2]);
+                    c.opcode = op;
+                    c.type   = in[1];
+                    c.value  = in[3] | (operands(4) ? static_cast<std::uint64_t>(in[4]) << 32 : 0u);
+                    break;
+                }
+                case spirv::OpSpecConstantTrue:
+                case spirv::OpSpecConstantFalse: {
+                    if (!operands(2)) break;
+                    auto& c  = def(in[2]);
+                    c.opcode = op;
+                    c.type   = in[1];
+                    c.value  = op == spirv::OpSpecConstantTrue ? 1u : 0u;
+                    break;
+                }
+                case spirv::OpVariable: {
+                    if (!operands(3)) break;
+                    auto& v  = def(in[2]);
+                    v.opcode = op;
+                    v.type   = in[1];
+                    v.extra  = in[3];
+                    break;
+                }
+                case spirv::OpDecorate: {
+                    if (!operands(2)) break;
+                    auto& t                   = def(in[1]);
+                    const std::uint32_t value = operands(3) ? in[3] : 0u;
+                    switch (in[2]) {
+                    case spirv::SpecId: t.spec_id = value; break;
+                    case spirv::Block: t.block = true; break;
+                    case spirv::BufferBlock: t.buffer_block = true; break;
+                    case spirv::ArrayStride: t.array_stride = value; break;
+                    case spirv::BuiltIn: t.builtin = true; break;
+                    case spirv::Location: t.location = value; break;
+                    case spirv::Binding: t.binding = value; break;
+                    case spirv::DescriptorSet: t.set = value; break;
+                    default: break;
+                    }
+                    break;
+                }
+                case spirv::OpMemberDecorate: {
+                    if (!operands(3)) break;
+                    auto& t = def(in[1]);
+                    if (t.member_layout.size() <= in[2]) t.member_layout.resize(in[2] + 1);
+                    auto& member              = t.member_layout[in[2]];
+                    const std::uint32_t value = operands(4) ? in[4] : 0u;
+                    switch (in[3]) {
+                    case spirv::RowMajor: member.row_major = true; break;
+                    case spirv::MatrixStride: member.matrix_stride = value; break;
+                    case spirv::Offset: member.offset = value; break;
+                    case spirv::BuiltIn: t.builtin = true; break;
+                    default: break;
+                    }
+                    break;
+                }
+                default: break;
+                }
+            }
+            return m;
+        }
+
+        // Byte size under the module's explicit layout decorations; runtime arrays count as 0.
+        [[nodiscard]] std::uint32_t type_size(const SpirvModule& m, const std::uint32_t id, const SpirvMember* member = nullptr, const std::uint32_t depth = 0) {
+            if (depth > 64) throw std::runtime_error("vk.pipeline: malformed SPIR-V (type nesting too deep)");
+            const SpirvId& t = m.at(id);
+            switch (t.opcode) {
+            case spirv::OpTypeBool: return 4;
+            case spirv::OpTypeInt:
+            case spirv::OpTypeFloat: return t.length / 8;
+            case spirv::OpTypeVector: return t.length * type_size(m, t.type, nullptr, depth + 1);
+            case spirv::OpTypeMatrix: {
+                if (!member || member->matrix_stride == 0) return t.length * type_size(m, t.type, nullptr, depth + 1);
+                const std::uint32_t rows = m.at(t.type).length;
+                return (member->row_major ? rows : t.length) * member->matrix_stride;
+            }
+            case spirv::OpTypeArray: {
+                const std::uint32_t n = m.array_length(t, std::numeric_limits<std::uint32_t>::max());
+                return n * (t.array_stride != 0 ? t.array_stride : type_size(m, t.type, member, depth + 1));
+            }
+            case spirv::OpTypeStruct: {
+                std::uint32_t end = 0;
+                for (std::size_t i = 0; i < t.members.size(); ++i) {
+                    const SpirvMember& layout = t.member_layout[i];
+                    end                       = std::max(end, layout.offset + type_size(m, t.members[i], &layout, depth + 1));
+                }
+                return end;
+            }
+            case spirv::OpTypePointer: return 8; // physical storage buffer address
+            default: return 0;
+            }
+        }
+
+        [[nodiscard]] std::optional<DescriptorType> descriptor_type(const SpirvId& type, const std::uint32_t storage) {
+            switch (type.opcode) {
+            case spirv::OpTypeSampler: return DescriptorType::eSampler;
+            case spirv::OpTypeSampledImage: return DescriptorType::eCombinedImageSampler;
+            case spirv::OpTypeAccelerationStructureKHR: return DescriptorType::eAccelerationStructureKHR;
+            case spirv::OpTypeImage:
+                if (type.length == spirv::DimBuffer) return type.extra == 2 ? DescriptorType::eStorageTexelBuffer : DescriptorType::eUniformTexelBuffer;
+                if (type.length == spirv::DimSubpassData) return DescriptorType::eInputAttachment;
+                return type.extra == 2 ? DescriptorType::eStorageImage : DescriptorType::eSampledImage;
+            case spirv::OpTypeStruct:
+                if (storage == spirv::StorageBuffer || type.buffer_block) return DescriptorType::eStorageBuffer;
+                if (storage == spirv::Uniform) return DescriptorType::eUniformBuffer;
+                return std::nullopt;
+            default: return std::nullopt;
+            }
+        }
+
+        [[nodiscard]] Format vertex_format(const SpirvId& scalar, const std::uint32_t components) {
+            using F = Format;
+            static constexpr std::array<std::array<F, 4>, 8> table{{
+                {F::eR16Sfloat, F::eR16G16Sfloat, F::eR16G16B16Sfloat, F::eR16G16B16A16Sfloat},
+                {F::eR32Sfloat, F::eR32G32Sfloat, F::eR32G32B32Sfloat, F::eR32G32B32A32Sfloat},
+                {F::eR64Sfloat, F::eR64G64Sfloat, F::eR64G64B64Sfloat, F::eR64G64B64A64Sfloat},
+                {F::eR16Sint, F::eR16G16Sint, F::eR16G16B16Sint, F::eR16G16B16A16Sint},
+                {F::eR32Sint, F::eR32G32Sint, F::eR32G32B32Sint, F::eR32G32B32A32Sint},
+                {F::eR16Uint, F::eR16G16Uint, F::eR16G16B16Uint, F::eR16G16B16A16Uint},
+                {F::eR32Uint, F::eR32G32Uint, F::eR32G32B32Uint, F::eR32G32B32A32Uint},
+                {F::eR64Uint, F::eR64G64Uint, F::eR64G64B64Uint, F::eR64G64B64A64Uint},
+            }};
+            if (components == 0 || components > 4) return F::eUndefined;
+
+            std::size_t row = 0;
+            if (scalar.opcode == spirv::OpTypeFloat && scalar.length >= 16 && scalar.length <= 64) row = scalar.length / 32;
+            else if (scalar.opcode == spirv::OpTypeInt && scalar.extra == 1 && (scalar.length == 16 || scalar.length == 32)) row = 3 + scalar.length / 32;
+            else if (scalar.opcode == spirv::OpTypeInt && scalar.extra == 0 && scalar.length >= 16 && scalar.length <= 64) row = 5 + scalar.length / 32;
+            else return F::eUndefined;
+            return table[row][components - 1];
+        }
+
+        // Matrices and arrays take one location per column or element.
+        void append_vertex_inputs(const SpirvModule& m, const std::uint32_t type_id, std::uint32_t& location, const std::string& name, std::vector<ReflectedVertexInput>& out, const std::uint32_t depth = 0) {
+            if (depth > 8) return;
+            if (location >= spirv::max_vertex_locations) throw std::runtime_error(std::format("vk.pipeline: vertex input '{}' needs more than {} locations", name, spirv::max_vertex_locations));
+            const SpirvId& t = m.at(type_id);
+            switch (t.opcode) {
+            case spirv::OpTypeArray:
+                for (std::uint32_t i = 0, n = m.array_length(t, spirv::max_vertex_locations); i < n; ++i) append_vertex_inputs(m, t.type, location, name, out, depth + 1);
+                return;
+            case spirv::OpTypeMatrix:
+                for (std::uint32_t i = 0; i < t.length; ++i) append_vertex_inputs(m, t.type, location, name, out, depth + 1);
+                return;
+            case spirv::OpTypeVector: {
+                const Format f = vertex_format(m.at(t.type), t.length);
+                out.push_back(ReflectedVertexInput{.location = location, .format = f, .name = name});
+                // 64-bit three- and four-component vectors take two locations.
+                location += f == Format::eR64G64B64Sfloat || f == Format::eR64G64B64A64Sfloat || f == Format::eR64G64B64Uint || f == Format::eR64G64B64A64Uint ? 2 : 1;
+                return;
+            }
+            default: out.push_back(ReflectedVertexInput{.location = location++, .format = vertex_format(t, 1), .name = name}); return;
+            }
+        }
+
+        [[nodiscard]] std::optional<ShaderStageFlagBits> stage_of(const std::uint32_t model) {
+            switch (model) {
+            case 0: return ShaderStageFlagBits::eVertex;
+            case 1: return ShaderStageFlagBits::eTessellationControl;
+            case 2: return ShaderStageFlagBits::eTessellationEvaluation;
+            case 3: return ShaderStageFlagBits::eGeometry;
+            case 4: return ShaderStageFlagBits::eFragment;
+            case 5: return ShaderStageFlagBits::eCompute;
+            case 5364: return ShaderStageFlagBits::eTaskEXT;
+            case 5365: return ShaderStageFlagBits::eMeshEXT;
+            default: return std::nullopt;
+            }
+        }
+
+        [[nodiscard]] std::string display_name(const SpirvModule& m, const SpirvId& var, const std::uint32_t type_id) {
+            if (!var.name.empty()) return var.name;
+            return m.at(type_id).name;
+        }
+
+        // Attribute formats are compared by numeric type only: float (including normalized and
+        // scaled formats), signed or unsigned integer.
+        [[nodiscard]] char numeric_class(const Format format) {
+            const std::string s = to_string(format);
+            if (s.contains("Sint")) return 'i';
+            if (s.contains("Uint")) return 'u';
+            return 'f';
+        }
+
+        [[nodiscard]] std::array<const ReflectedEntryPoint*, 2> find_entries(const ShaderReflection& reflection, const std::string_view vs_entry, const std::string_view fs_entry) {
+            const auto find = [&](const std::string_view name, const ShaderStageFlagBits stage) {
+                const auto it = std::ranges::find_if(reflection.entry_points, [&](const ReflectedEntryPoint& e) { return e.name == name && e.stage == stage; });
+                if (it == reflection.entry_points.end()) throw std::runtime_error(std::format("vk.pipeline: shader has no {} entry point '{}'", to_string(stage), name));
+                return &*it;
+            };
+            return {find(vs_entry, ShaderStageFlagBits::eVertex), find(fs_entry, ShaderStageFlagBits::eFragment)};
+        }
+    } // namespace
+} // namespace vk::pipeline
+
 std::vector<std::byte> vk::pipeline::read_file_bytes(const std::string& path) {
     std::ifstream f(path, std::ios::binary | std::ios::ate);
     if (!f) throw std::runtime_error("vk.pipeline: failed to open file: " + path);
@@ -29,120 +549,833 @@ vk::raii::ShaderModule vk::pipeline::load_shader_module(const raii::Device& devi
     return raii::ShaderModule{device, ci};
 }
 
-vk::pipeline::GraphicsPipeline vk::pipeline::create_graphics_pipeline(const raii::Device& device, const VertexInput& vin, const GraphicsPipelineDesc& desc, const raii::ShaderModule& shader_module, const char* vs_entry, const char* fs_entry) {
-    GraphicsPipeline out{};
+vk::pipeline::ShaderReflection vk::pipeline::reflect_shader(const std::span<const std::byte> spv) {
+    const SpirvModule m = parse_spirv(spv);
+
+    ShaderReflection out{};
+    out.spirv_version = m.version;
+
+    // Variable id -> index into out.bindings / out.push_blocks.
+    std::unordered_map<std::uint32_t, std::uint32_t> binding_index;
+    std::unordered_map<std::uint32_t, std::uint32_t> push_index;
+
+    for (std::uint32_t id = 0; id < m.ids.size(); ++id) {
+        const SpirvId& v = m.ids[id];
+
+        if (v.spec_id && (v.opcode == spirv::OpSpecConstant || v.opcode == spirv::OpSpecConstantTrue || v.opcode == spirv::OpSpecConstantFalse)) {
+            out.spec_constants.push_back(ReflectedSpecConstant{
+                .id            = *v.spec_id,
+                .size          = type_size(m, v.type),
+                .default_value = v.value,
+                .name          = v.name,
+            });
+            continue;
+        }
+        if (v.opcode != spirv::OpVariable) continue;
+
+        std::uint32_t type_id = m.at(v.type).type;
+        if (v.extra == spirv::PushConstant) {
+            const SpirvId& block = m.at(type_id);
+            if (block.opcode != spirv::OpTypeStruct || block.members.empty()) continue;
+
+            std::uint32_t offset = std::numeric_limits<std::uint32_t>::max();
+            for (std::size_t i = 0; i < block.members.size(); ++i) offset = std::min(offset, block.member_layout[i].offset);
+            const std::uint32_t end = type_size(m, type_id);
 
-    std::vector<PushConstantRange> pcrs;
-    if (desc.push_constant_bytes > 0) {
-        pcrs.push_back(PushConstantRange{
-            .stageFlags = desc.push_constant_stages,
-            .offset     = 0,
-            .size       = desc.push_constant_bytes,
+            push_index.emplace(id, static_cast<std::uint32_t>(out.push_blocks.size()));
+            out.push_blocks.push_back(ReflectedPushBlock{
+                .offset = offset,
+                .size   = (std::max(end, offset) - offset + 3u) & ~3u,
+                .name   = display_name(m, v, type_id),
+            });
+            continue;
+        }
+
+        if (!v.set || !v.binding) continue;
+        if (v.extra != spirv::UniformConstant && v.extra != spirv::Uniform && v.extra != spirv::StorageBuffer) continue;
+
+        std::uint32_t count = 1;
+        for (std::uint32_t depth = 0; depth < 16; ++depth) {
+            const SpirvId& t = m.at(type_id);
+            if (t.opcode == spirv::OpTypeArray) {
+                const std::uint32_t n = m.array_length(t, spirv::max_descriptor_count);
+                if (n != 0 && count > spirv::max_descriptor_count / n) throw std::runtime_error(std::format("vk.pipeline: binding '{}' has more than {} descriptors", display_name(m, v, type_id), spirv::max_descriptor_count));
+                count *= n;
+            } else if (t.opcode == spirv::OpTypeRuntimeArray) count = 0;
+            else break;
+            type_id = t.type;
+        }
+
+        const auto type = descriptor_type(m.at(type_id), v.extra);
+        if (!type) continue;
+
+        binding_index.emplace(id, static_cast<std::uint32_t>(out.bindings.size()));
+        out.bindings.push_back(ReflectedBinding{
+            .set     = *v.set,
+            .binding = *v.binding,
+            .type    = *type,
+            .count   = count,
+            .name    = display_name(m, v, type_id),
         });
     }
 
-    const PipelineLayoutCreateInfo plci{
-        .setLayoutCount         = static_cast<std::uint32_t>(desc.set_layouts.size()),
-        .pSetLayouts            = desc.set_layouts.empty() ? nullptr : desc.set_layouts.data(),
-        .pushConstantRangeCount = static_cast<std::uint32_t>(pcrs.size()),
-        .pPushConstantRanges    = pcrs.empty() ? nullptr : pcrs.data(),
-    };
+    // Before SPIR-V 1.4 the interface lists only Input/Output variables.
+    const bool per_entry = m.version >= 0x0001'0400u;
+    for (const SpirvEntry& e : m.entries) {
+        const auto stage = stage_of(e.model);
+        if (!stage) continue;
 
-    out.layout = raii::PipelineLayout{device, plci};
-
-    const std::array<PipelineShaderStageCreateInfo, 2> stages{{
-        PipelineShaderStageCreateInfo{
-            .stage  = ShaderStageFlagBits::eVertex,
-            .module = *shader_module,
-            .pName  = vs_entry,
-        },
-        PipelineShaderStageCreateInfo{
-            .stage  = ShaderStageFlagBits::eFragment,
-            .module = *shader_module,
-            .pName  = fs_entry,
-        },
-    }};
-
-    const bool has_vertices = !vin.attributes.empty();
-    const PipelineVertexInputStateCreateInfo vi{
-        .vertexBindingDescriptionCount   = has_vertices ? 1u : 0u,
-        .pVertexBindingDescriptions      = has_vertices ? &vin.binding : nullptr,
-        .vertexAttributeDescriptionCount = static_cast<std::uint32_t>(vin.attributes.size()),
-        .pVertexAttributeDescriptions    = vin.attributes.empty() ? nullptr : vin.attributes.data(),
-    };
+        ReflectedEntryPoint ep{.name = e.name, .stage = *stage};
+        if (per_entry) {
+            for (const std::uint32_t id : e.interface) {
+                if (const auto it = binding_index.find(id); it != binding_index.end()) ep.bindings.push_back(it->second);
+                if (const auto it = push_index.find(id); it != push_index.end()) ep.push_blocks.push_back(it->second);
+            }
+        } else {
+            ep.bindings.resize(out.bindings.size());
+            std::iota(ep.bindings.begin(), ep.bindings.end(), 0u);
+            ep.push_blocks.resize(out.push_blocks.size());
+            std::iota(ep.push_blocks.begin(), ep.push_blocks.end(), 0u);
+        }
 
-    const PipelineInputAssemblyStateCreateInfo ia{
-        .topology = desc.topology,
-    };
+        if (*stage == ShaderStageFlagBits::eVertex) {
+            for (const std::uint32_t id : e.interface) {
+                const SpirvId& v = m.at(id);
+                if (v.opcode != spirv::OpVariable || v.extra != spirv::Input || v.builtin || !v.location) continue;
 
-    const PipelineViewportStateCreateInfo vp{
-        .viewportCount = 1,
-        .scissorCount  = 1,
-    };
+                const std::uint32_t type_id = m.at(v.type).type;
+                if (m.at(type_id).builtin) continue;
 
-    const PipelineRasterizationStateCreateInfo rs{
-        .polygonMode = desc.polygon_mode,
-        .cullMode    = desc.cull,
-        .frontFace   = desc.front_face,
-        .lineWidth   = 1.0f,
-    };
+                std::uint32_t location = *v.location;
+                append_vertex_inputs(m, type_id, location, display_name(m, v, type_id), ep.inputs);
+            }
+            std::ranges::sort(ep.inputs, {}, &ReflectedVertexInput::location);
+        }
 
-    const PipelineMultisampleStateCreateInfo ms{
-        .rasterizationSamples = SampleCountFlagBits::e1,
-    };
+        out.entry_points.push_back(std::move(ep));
+    }
+    return out;
+}
+
+namespace vk::pipeline {
+    namespace {
+        [[nodiscard]] raii::PipelineLayout create_layout(const raii::Device& device, const GraphicsPipelineDesc& desc) {
+            std::vector<PushConstantRange> pcrs;
+            if (desc.push_constant_bytes > 0) {
+                pcrs.push_back(PushConstantRange{
+                    .stageFlags = desc.push_constant_stages,
+                    .offset     = 0,
+                    .size       = desc.push_constant_bytes,
+                });
+            }
+
+            const PipelineLayoutCreateInfo plci{
+                .setLayoutCount         = static_cast<std::uint32_t>(desc.set_layouts.size()),
+                .pSetLayouts            = desc.set_layouts.empty() ? nullptr : desc.set_layouts.data(),
+                .pushConstantRangeCount = static_cast<std::uint32_t>(pcrs.size()),
+                .pPushConstantRanges    = pcrs.empty() ? nullptr : pcrs.data(),
+            };
 
-    PipelineDepthStencilStateCreateInfo ds{};
-    if (desc.use_depth) {
-        ds = PipelineDepthStencilStateCreateInfo{
-            .depthTestEnable  = VK_TRUE,
-            .depthWriteEnable = VK_TRUE,
-            .depthCompareOp   = CompareOp::eLessOrEqual,
+            return raii::PipelineLayout{device, plci};
+        }
+
+        // Holds the registry's set layouts for as long as a pipeline layout built from them lives,
+        // so trim() cannot free a set layout a live pipeline layout was built from.
+        struct LayoutHolder {
+            std::vector<std::shared_ptr<const raii::DescriptorSetLayout>> sets{};
+            raii::PipelineLayout layout{nullptr};
         };
+
+        // The caller holds registry.mutex. `pins` receives the set layouts so they outlive the key.
+        [[nodiscard]] LayoutKey make_layout_key(const PipelineRegistry& registry, const GraphicsPipelineDesc& desc, std::vector<std::shared_ptr<const raii::DescriptorSetLayout>>* pins = nullptr) {
+            LayoutKey key{
+                .push_constant_bytes  = desc.push_constant_bytes,
+                .push_constant_stages = desc.push_constant_bytes > 0 ? desc.push_constant_stages : ShaderStageFlags{},
+            };
+            for (const DescriptorSetLayout handle : desc.set_layouts) {
+                const auto owner = registry.set_layout_keys.find(handle);
+                if (owner == registry.set_layout_keys.end()) throw std::runtime_error("vk.pipeline: registry pipelines need set layouts from acquire_set_layout or acquire_reflected_layout");
+                key.sets.push_back(owner->second);
+                if (pins) pins->push_back(registry.set_layouts.at(owner->second));
+            }
+            return key;
+        }
+
+        [[nodiscard]] PipelineKey make_pipeline_key(LayoutKey layout, const VertexInput& vin, const GraphicsPipelineDesc& desc, const ShaderHandle& shader, const std::string_view vs_entry, const std::string_view fs_entry) {
+            PipelineKey key{
+                .layout               = std::move(layout),
+                .shader               = shader.module,
+                .vs_entry             = std::string{vs_entry},
+                .fs_entry             = std::string{fs_entry},
+                .binding              = vin.binding,
+                .attributes           = vin.attributes,
+                .color_format         = desc.color_format,
+                .depth_format         = desc.use_depth ? desc.depth_format : Format::eUndefined,
+                .use_depth            = desc.use_depth,
+                .use_blend            = desc.use_blend,
+                .dynamic_raster_state = desc.dynamic_raster_state,
+                .dynamic_polygon_mode = desc.dynamic_polygon_mode,
+            };
+            if (desc.dynamic_raster_state) {
+                key.topology = topology_class(desc.topology);
+            } else {
+                key.topology   = static_cast<std::uint32_t>(desc.topology);
+                key.cull       = desc.cull;
+                key.front_face = desc.front_face;
+            }
+            if (!desc.dynamic_polygon_mode) key.polygon_mode = desc.polygon_mode;
+            return key;
+        }
+
+        // Everything GraphicsPipelineCreateInfo points at, so several pipelines can be described
+        // up front and created in one createGraphicsPipelines call. Filled in place; not movable.
+        struct PipelineState {
+            std::array<PipelineShaderStageCreateInfo, 2> stages{};
+            PipelineVertexInputStateCreateInfo vi{};
+            PipelineInputAssemblyStateCreateInfo ia{};
+            PipelineViewportStateCreateInfo vp{};
+            PipelineRasterizationStateCreateInfo rs{};
+            PipelineMultisampleStateCreateInfo ms{};
+            PipelineDepthStencilStateCreateInfo ds{};
+            PipelineColorBlendAttachmentState blend_att{};
+            PipelineColorBlendStateCreateInfo cb{};
+            std::vector<DynamicState> dyn_states{};
+            PipelineDynamicStateCreateInfo dyn{};
+            Format color_format{};
+            PipelineRenderingCreateInfo rendering{};
+            PipelineCreationFeedbackCreateInfo feedback_ci{};
+            GraphicsPipelineCreateInfo info{};
+
+            PipelineState()                                = default;
+            PipelineState(const PipelineState&)            = delete;
+            PipelineState& operator=(const PipelineState&) = delete;
+        };
+
+        void fill_state(PipelineState& st, const VertexInput& vin, const GraphicsPipelineDesc& desc, const ShaderModule shader_module, const char* vs_entry, const char* fs_entry, const PipelineLayout layout, PipelineCreationFeedback* feedback) {
+            st.stages = {{
+                PipelineShaderStageCreateInfo{
+                    .stage  = ShaderStageFlagBits::eVertex,
+                    .module = shader_module,
+                    .pName  = vs_entry,
+                },
+                PipelineShaderStageCreateInfo{
+                    .stage  = ShaderStageFlagBits::eFragment,
+                    .module = shader_module,
+                    .pName  = fs_entry,
+                },
+            }};
+
+            const bool has_vertices = !vin.attributes.empty();
+
+            st.vi = PipelineVertexInputStateCreateInfo{
+                .vertexBindingDescriptionCount   = has_vertices ? 1u : 0u,
+                .pVertexBindingDescriptions      = has_vertices ? &vin.binding : nullptr,
+                .vertexAttributeDescriptionCount = static_cast<std::uint32_t>(vin.attributes.size()),
+                .pVertexAttributeDescriptions    = vin.attributes.empty() ? nullptr : vin.attributes.data(),
+            };
+
+            st.ia = PipelineInputAssemblyStateCreateInfo{
+                .topology = desc.topology,
+            };
+
+            st.vp = PipelineViewportStateCreateInfo{
+                .viewportCount = 1,
+                .scissorCount  = 1,
+            };
+
+            st.rs = PipelineRasterizationStateCreateInfo{
+                .polygonMode = desc.polygon_mode,
+                .cullMode    = desc.cull,
+                .frontFace   = desc.front_face,
+                .lineWidth   = 1.0f,
+            };
+
+            st.ms = PipelineMultisampleStateCreateInfo{
+                .rasterizationSamples = SampleCountFlagBits::e1,
+            };
+
+            // With dynamic depth state these are only initial values, overridden per draw.
+            if (desc.use_depth || desc.dynamic_raster_state) {
+                st.ds = PipelineDepthStencilStateCreateInfo{
+                    .depthTestEnable  = VK_TRUE,
+                    .depthWriteEnable = VK_TRUE,
+                    .depthCompareOp   = CompareOp::eLessOrEqual,
+                };
+            }
+
+            st.blend_att = detail::make_blend_attachment(desc.use_blend);
+
+            st.cb = PipelineColorBlendStateCreateInfo{
+                .attachmentCount = 1,
+                .pAttachments    = &st.blend_att,
+            };
+
+            st.dyn_states = {DynamicState::eViewport, DynamicState::eScissor};
+            if (desc.dynamic_raster_state) {
+                st.dyn_states.insert(st.dyn_states.end(), {DynamicState::eCullMode, DynamicState::eFrontFace, DynamicState::ePrimitiveTopology, DynamicState::eDepthTestEnable, DynamicState::eDepthWriteEnable, DynamicState::eDepthCompareOp});
+            }
+            if (desc.dynamic_polygon_mode) st.dyn_states.push_back(DynamicState::ePolygonModeEXT);
+
+            st.dyn = PipelineDynamicStateCreateInfo{
+                .dynamicStateCount = static_cast<std::uint32_t>(st.dyn_states.size()),
+                .pDynamicStates    = st.dyn_states.data(),
+            };
+
+            st.color_format = desc.color_format;
+
+            st.rendering = PipelineRenderingCreateInfo{
+                .colorAttachmentCount    = 1,
+                .pColorAttachmentFormats = &st.color_format,
+            };
+
+            if (desc.use_depth) {
+                st.rendering.depthAttachmentFormat = desc.depth_format;
+                if (detail::has_stencil(desc.depth_format)) {
+                    st.rendering.stencilAttachmentFormat = desc.depth_format;
+                }
+            }
+
+            st.feedback_ci = PipelineCreationFeedbackCreateInfo{
+                .pPipelineCreationFeedback = feedback,
+            };
+            if (feedback) st.rendering.pNext = &st.feedback_ci;
+
+            st.info = GraphicsPipelineCreateInfo{
+                .pNext               = &st.rendering,
+                .stageCount          = static_cast<std::uint32_t>(st.stages.size()),
+                .pStages             = st.stages.data(),
+                .pVertexInputState   = &st.vi,
+                .pInputAssemblyState = &st.ia,
+                .pViewportState      = &st.vp,
+                .pRasterizationState = &st.rs,
+                .pMultisampleState   = &st.ms,
+                .pDepthStencilState  = desc.use_depth || desc.dynamic_raster_state ? &st.ds : nullptr,
+                .pColorBlendState    = &st.cb,
+                .pDynamicState       = &st.dyn,
+                .layout              = layout,
+            };
+        }
+
+        [[nodiscard]] raii::Pipeline create_one(const raii::Device& device, const PipelineCache* cache, const GraphicsPipelineCreateInfo& info) {
+            if (!cache) return raii::Pipeline{device, nullptr, info};
+            return raii::Pipeline{device, cache->cache, info};
+        }
+
+        [[nodiscard]] raii::Pipeline create_pipeline(const raii::Device& device, const VertexInput& vin, const GraphicsPipelineDesc& desc, const raii::ShaderModule& shader_module, const char* vs_entry, const char* fs_entry, const PipelineLayout layout, const PipelineCache* cache, PipelineCreationFeedback* feedback) {
+            PipelineState st{};
+            fill_state(st, vin, desc, *shader_module, vs_entry, fs_entry, layout, feedback);
+            return create_one(device, cache, st.info);
+        }
+
+        // Creates a batch with one createGraphicsPipelines call. Layout failures only affect their
+        // own job; if the batched call fails the jobs are retried one by one to find the culprit.
+        void compile_batch(PipelineCompiler& c, std::vector<PipelineCompiler::Job>& batch) {
+            const auto t0              = std::chrono::steady_clock::now();
+            const PipelineCache* cache = c.registry->cache;
+            const std::size_t n        = batch.size();
+
+            std::vector<SharedPipeline> out(n);
+            std::vector<std::exception_ptr> errors(n);
+            std::vector<PipelineState> states(n);
+            std::vector<PipelineCreationFeedback> feedback(n);
+            std::vector<GraphicsPipelineCreateInfo> infos;
+            std::vector<std::size_t> slots;
+
+            for (std::size_t i = 0; i < n; ++i) {
+                const PipelineJob& job = batch[i].request;
+                try {
+                    out[i].layout = acquire_layout(*c.registry, *c.device, job.desc);
+                    fill_state(states[i], job.vin, job.desc, **job.shader.module, job.vs_entry.c_str(), job.fs_entry.c_str(), **out[i].layout, cache ? &feedback[i] : nullptr);
+                    infos.push_back(states[i].info);
+                    slots.push_back(i);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }
+
+            std::uint32_t calls = 0;
+            if (!infos.empty()) {
+                try {
+                    ++calls;
+                    auto created = cache ? c.device->createGraphicsPipelines(cache->cache, infos) : c.device->createGraphicsPipelines(nullptr, infos);
+                    for (std::size_t k = 0; k < slots.size(); ++k) out[slots[k]].pipeline = std::make_shared<const raii::Pipeline>(std::move(created[k]));
+                } catch (...) {
+                    for (const std::size_t i : slots) {
+                        try {
+                            ++calls;
+                            out[i].pipeline = std::make_shared<const raii::Pipeline>(create_one(*c.device, cache, states[i].info));
+                        } catch (...) {
+                            errors[i] = std::current_exception();
+                        }
+                    }
+                }
+            }
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+            std::uint32_t failed = 0;
+            {
+                // The cache's feedback stats are guarded by the registry lock.
+                std::scoped_lock lock{c.registry->mutex};
+                for (std::size_t i = 0; i < n; ++i) {
+                    if (errors[i]) {
+                        ++failed;
+                        continue;
+                    }
+                    if (cache) record_feedback(*c.registry->cache, feedback[i]);
+                    const auto [it, inserted] = c.registry->pipelines.try_emplace(batch[i].key, std::move(out[i]));
+                    ++(inserted ? c.registry->stats.pipeline_misses : c.registry->stats.pipeline_hits);
+                    out[i] = it->second;
+                }
+            }
+
+            // The in_flight entries are only erased after this, so compile_async always finds a
+            // pipeline either in the registry or in flight.
+            for (std::size_t i = 0; i < n; ++i) {
+                if (errors[i]) batch[i].promise.set_exception(errors[i]);
+                else batch[i].promise.set_value(std::move(out[i]));
+            }
+
+            std::scoped_lock lock{c.mutex};
+            c.stats.completed += static_cast<std::uint32_t>(n) - failed;
+            c.stats.failed += failed;
+            c.stats.batches += calls;
+            c.stats.compile_ms += ms;
+        }
+
+        void run_compiler(const std::stop_token stop, PipelineCompiler& c, const std::uint32_t threads) {
+            for (;;) {
+                std::vector<PipelineCompiler::Job> batch;
+                {
+                    std::unique_lock lock{c.mutex};
+                    c.wake.wait(lock, stop, [&] { return !c.queue.empty(); });
+                    if (stop.stop_requested()) return;
+
+                    // An even share of the queue per worker, so a burst of submissions spreads
+                    // across all threads instead of the first worker taking a full batch.
+                    const std::size_t share = (c.queue.size() + threads - 1) / threads;
+                    const std::size_t take  = std::clamp<std::size_t>(share, 1, c.max_batch);
+                    for (std::size_t i = 0; i < take; ++i) {
+                        batch.push_back(std::move(c.queue.front()));
+                        c.queue.pop_front();
+                    }
+                    c.active += static_cast<std::uint32_t>(take);
+                }
+
+                compile_batch(c, batch);
+
+                {
+                    std::scoped_lock lock{c.mutex};
+                    for (const auto& job : batch) c.in_flight.erase(job.key);
+                    c.active -= static_cast<std::uint32_t>(batch.size());
+                }
+                c.idle.notify_all();
+            }
+        }
+    } // namespace
+} // namespace vk::pipeline
+
+vk::pipeline::GraphicsPipeline vk::pipeline::create_graphics_pipeline(const raii::Device& device, const VertexInput& vin, const GraphicsPipelineDesc& desc, const raii::ShaderModule& shader_module, const char* vs_entry, const char* fs_entry, PipelineCache* cache) {
+    GraphicsPipeline out{};
+    out.layout = create_layout(device, desc);
+
+    PipelineCreationFeedback feedback{};
+    out.pipeline = create_pipeline(device, vin, desc, shader_module, vs_entry, fs_entry, *out.layout, cache, cache ? &feedback : nullptr);
+    if (cache) record_feedback(*cache, feedback);
+    return out;
+}
+
+void vk::pipeline::set_raster_state(const raii::CommandBuffer& cmd, const GraphicsPipelineDesc& desc, const RasterState& state) {
+    if (desc.dynamic_raster_state) {
+        cmd.setCullMode(state.cull);
+        cmd.setFrontFace(state.front_face);
+        cmd.setPrimitiveTopology(state.topology);
+        cmd.setDepthTestEnable(state.depth_test);
+        cmd.setDepthWriteEnable(state.depth_write);
+        cmd.setDepthCompareOp(state.depth_compare);
     }
+    if (desc.dynamic_polygon_mode) cmd.setPolygonModeEXT(state.polygon_mode);
+}
 
-    const auto blend_att = detail::make_blend_attachment(desc.use_blend);
-    const PipelineColorBlendStateCreateInfo cb{
-        .attachmentCount = 1,
-        .pAttachments    = &blend_att,
-    };
+std::size_t vk::pipeline::KeyHash::operator()(const ShaderKey& key) const {
+    return fnv1a(key.spv);
+}
 
-    constexpr std::array dyn_states{
-        DynamicState::eViewport,
-        DynamicState::eScissor,
-    };
+std::size_t vk::pipeline::KeyHash::operator()(const SetLayoutKey& key) const {
+    std::uint64_t h = 0;
+    for (const auto& b : key.bindings) {
+        hash_combine(h, b.binding);
+        hash_combine(h, static_cast<std::uint64_t>(b.descriptorType));
+        hash_combine(h, b.descriptorCount);
+        hash_combine(h, static_cast<VkShaderStageFlags>(b.stageFlags));
+    }
+    hash_combine(h, key.bindings.size());
+    return h;
+}
 
-    const PipelineDynamicStateCreateInfo dyn{
-        .dynamicStateCount = static_cast<std::uint32_t>(dyn_states.size()),
-        .pDynamicStates    = dyn_states.data(),
+std::size_t vk::pipeline::KeyHash::operator()(const LayoutKey& key) const {
+    std::uint64_t h = 0;
+    for (const auto& set : key.sets) hash_combine(h, (*this)(set));
+    hash_combine(h, key.sets.size());
+    hash_combine(h, key.push_constant_bytes);
+    hash_combine(h, static_cast<VkShaderStageFlags>(key.push_constant_stages));
+    return h;
+}
+
+std::size_t vk::pipeline::KeyHash::operator()(const PipelineKey& key) const {
+    std::uint64_t h = (*this)(key.layout);
+    hash_combine(h, reinterpret_cast<std::uintptr_t>(key.shader.get()));
+    hash_combine(h, std::hash<std::string>{}(key.vs_entry));
+    hash_combine(h, std::hash<std::string>{}(key.fs_entry));
+
+    hash_combine(h, key.binding.binding);
+    hash_combine(h, key.binding.stride);
+    hash_combine(h, static_cast<std::uint64_t>(key.binding.inputRate));
+    for (const auto& a : key.attributes) {
+        hash_combine(h, a.location);
+        hash_combine(h, a.binding);
+        hash_combine(h, static_cast<std::uint64_t>(a.format));
+        hash_combine(h, a.offset);
+    }
+    hash_combine(h, key.attributes.size());
+
+    hash_combine(h, static_cast<std::uint64_t>(key.color_format));
+    hash_combine(h, static_cast<std::uint64_t>(key.depth_format));
+    hash_combine(h, key.use_depth);
+    hash_combine(h, key.use_blend);
+    hash_combine(h, key.dynamic_raster_state);
+    hash_combine(h, key.dynamic_polygon_mode);
+    hash_combine(h, key.topology);
+    hash_combine(h, static_cast<VkCullModeFlags>(key.cull));
+    hash_combine(h, static_cast<std::uint64_t>(key.front_face));
+    hash_combine(h, static_cast<std::uint64_t>(key.polygon_mode));
+    return h;
+}
+
+vk::pipeline::ShaderHandle vk::pipeline::acquire_shader(PipelineRegistry& registry, const raii::Device& device, const std::span<const std::byte> spv) {
+    ShaderKey key{.spv = {spv.begin(), spv.end()}};
+    {
+        std::scoped_lock lock{registry.mutex};
+        if (const auto it = registry.shaders.find(key); it != registry.shaders.end()) {
+            ++registry.stats.shader_hits;
+            return it->second;
+        }
+    }
+
+    // Created outside the lock; if another thread won the race its module is kept.
+    ShaderHandle created{
+        .module     = std::make_shared<const raii::ShaderModule>(load_shader_module(device, spv)),
+        .reflection = std::make_shared<const ShaderReflection>(reflect_shader(spv)),
+        .hash       = fnv1a(spv),
     };
+    std::scoped_lock lock{registry.mutex};
+    const auto [it, inserted] = registry.shaders.try_emplace(std::move(key), std::move(created));
+    ++(inserted ? registry.stats.shader_misses : registry.stats.shader_hits);
+    return it->second;
+}
 
-    PipelineRenderingCreateInfo rendering{
-        .colorAttachmentCount    = 1,
-        .pColorAttachmentFormats = &desc.color_format,
+std::shared_ptr<const vk::raii::DescriptorSetLayout> vk::pipeline::acquire_set_layout(PipelineRegistry& registry, const raii::Device& device, const std::span<const DescriptorSetLayoutBinding> bindings) {
+    SetLayoutKey key{.bindings = {bindings.begin(), bindings.end()}};
+    std::ranges::sort(key.bindings, {}, &DescriptorSetLayoutBinding::binding);
+    {
+        std::scoped_lock lock{registry.mutex};
+        if (const auto it = registry.set_layouts.find(key); it != registry.set_layouts.end()) {
+            ++registry.stats.set_layout_hits;
+            return it->second;
+        }
+    }
+
+    const DescriptorSetLayoutCreateInfo ci{
+        .bindingCount = static_cast<std::uint32_t>(key.bindings.size()),
+        .pBindings    = key.bindings.empty() ? nullptr : key.bindings.data(),
     };
+    auto created = std::make_shared<const raii::DescriptorSetLayout>(device, ci);
+
+    std::scoped_lock lock{registry.mutex};
+    const auto [it, inserted] = registry.set_layouts.try_emplace(std::move(key), std::move(created));
+    if (inserted) registry.set_layout_keys.emplace(**it->second, it->first);
+    ++(inserted ? registry.stats.set_layout_misses : registry.stats.set_layout_hits);
+    return it->second;
+}
+
+std::shared_ptr<const vk::raii::PipelineLayout> vk::pipeline::acquire_layout(PipelineRegistry& registry, const raii::Device& device, const GraphicsPipelineDesc& desc) {
+    auto holder = std::make_shared<LayoutHolder>();
+    LayoutKey key{};
+    {
+        std::scoped_lock lock{registry.mutex};
+        key = make_layout_key(registry, desc, &holder->sets);
+        if (const auto it = registry.layouts.find(key); it != registry.layouts.end()) {
+            ++registry.stats.layout_hits;
+            return it->second;
+        }
+    }
+
+    holder->layout = create_layout(device, desc);
+
+    std::scoped_lock lock{registry.mutex};
+    const auto [it, inserted] = registry.layouts.try_emplace(std::move(key), std::shared_ptr<const raii::PipelineLayout>{holder, &holder->layout});
+    ++(inserted ? registry.stats.layout_misses : registry.stats.layout_hits);
+    return it->second;
+}
+
+vk::pipeline::SharedPipeline vk::pipeline::acquire_pipeline(PipelineRegistry& registry, const raii::Device& device, const VertexInput& vin, const GraphicsPipelineDesc& desc, const ShaderHandle& shader, const char* vs_entry, const char* fs_entry) {
+    if (!shader.module) throw std::runtime_error("vk.pipeline: acquire_pipeline needs a shader from acquire_shader");
+    if (desc.dynamic_polygon_mode && !registry.dynamic_polygon_mode) throw std::runtime_error("vk.pipeline: dynamic_polygon_mode needs extendedDynamicState3PolygonMode");
+
+    PipelineKey key{};
+    {
+        std::scoped_lock lock{registry.mutex};
+        key = make_pipeline_key(make_layout_key(registry, desc), vin, desc, shader, vs_entry, fs_entry);
+        if (const auto it = registry.pipelines.find(key); it != registry.pipelines.end()) {
+            ++registry.stats.pipeline_hits;
+            return it->second;
+        }
+    }
+
+    if (shader.reflection) validate_pipeline(*shader.reflection, vin, desc, vs_entry, fs_entry);
+
+    SharedPipeline created{};
+    PipelineCreationFeedback feedback{};
+    created.layout   = acquire_layout(registry, device, desc);
+    created.pipeline = std::make_shared<const raii::Pipeline>(create_pipeline(device, vin, desc, *shader.module, vs_entry, fs_entry, **created.layout, registry.cache, registry.cache ? &feedback : nullptr));
+
+    // The cache's feedback stats are guarded by the registry lock.
+    std::scoped_lock lock{registry.mutex};
+    if (registry.cache) record_feedback(*registry.cache, feedback);
+    const auto [it, inserted] = registry.pipelines.try_emplace(std::move(key), std::move(created));
+    ++(inserted ? registry.stats.pipeline_misses : registry.stats.pipeline_hits);
+    return it->second;
+}
+
+vk::pipeline::ReflectedLayout vk::pipeline::acquire_reflected_layout(PipelineRegistry& registry, const raii::Device& device, const ShaderHandle& shader, const char* vs_entry, const char* fs_entry) {
+    if (!shader.reflection) throw std::runtime_error("vk.pipeline: acquire_reflected_layout needs a shader from acquire_shader");
+    const ShaderReflection& reflection = *shader.reflection;
 
-    if (desc.use_depth) {
-        rendering.depthAttachmentFormat = desc.depth_format;
-        if (detail::has_stencil(desc.depth_format)) {
-            rendering.stencilAttachmentFormat = desc.depth_format;
-        }
-    }
-
-    const GraphicsPipelineCreateInfo gpi{
-        .pNext               = &rendering,
-        .stageCount          = static_cast<std::uint32_t>(stages.size()),
-        .pStages             = stages.data(),
-        .pVertexInputState   = &vi,
-        .pInputAssemblyState = &ia,
-        .pViewportState      = &vp,
-        .pRasterizationState = &rs,
-        .pMultisampleState   = &ms,
-        .pDepthStencilState  = desc.use_depth ? &ds : nullptr,
-        .pColorBlendState    = &cb,
-        .pDynamicState       = &dyn,
-        .layout              = *out.layout,
+    ReflectedLayout out{};
+    for (const ReflectedEntryPoint* entry : find_entries(reflection, vs_entry, fs_entry)) {
+        for (const std::uint32_t index : entry->bindings) {
+            const ReflectedBinding& b = reflection.bindings[index];
+            if (b.count == 0) throw std::runtime_error(std::format("vk.pipeline: '{}' (set {}, binding {}) is a runtime-sized array; its layout must be built by hand", b.name, b.set, b.binding));
+
+            if (out.bindings.size() <= b.set) out.bindings.resize(b.set + 1);
+            auto& set     = out.bindings[b.set];
+            const auto it = std::ranges::find(set, b.binding, &DescriptorSetLayoutBinding::binding);
+            if (it == set.end()) {
+                set.push_back(DescriptorSetLayoutBinding{
+                    .binding         = b.binding,
+                    .descriptorType  = b.type,
+                    .descriptorCount = b.count,
+                    .stageFlags      = entry->stage,
+                });
+                continue;
+            }
+            if (it->descriptorType != b.type || it->descriptorCount != b.count) {
+                throw std::runtime_error(std::format("vk.pipeline: set {} binding {} is declared as {} x{} and as {} x{} ('{}')", b.set, b.binding, to_string(it->descriptorType), it->descriptorCount, to_string(b.type), b.count, b.name));
+            }
+            it->stageFlags |= entry->stage;
+        }
+
+        for (const std::uint32_t index : entry->push_blocks) {
+            const ReflectedPushBlock& p = reflection.push_blocks[index];
+            out.push_constant_bytes     = std::max(out.push_constant_bytes, p.offset + p.size);
+            out.push_constant_stages |= entry->stage;
+        }
+    }
+
+    // Unused set numbers below the highest one get empty layouts.
+    for (auto& set : out.bindings) {
+        std::ranges::sort(set, {}, &DescriptorSetLayoutBinding::binding);
+        out.sets.push_back(acquire_set_layout(registry, device, set));
+        out.handles.push_back(**out.sets.back());
+    }
+    return out;
+}
+
+void vk::pipeline::apply_layout(const ReflectedLayout& layout, GraphicsPipelineDesc& desc) {
+    desc.set_layouts         = layout.handles;
+    desc.push_constant_bytes = layout.push_constant_bytes;
+    if (layout.push_constant_bytes > 0) desc.push_constant_stages = layout.push_constant_stages;
+}
+
+void vk::pipeline::validate_pipeline(const ShaderReflection& reflection, const VertexInput& vin, const GraphicsPipelineDesc& desc, const char* vs_entry, const char* fs_entry) {
+    const auto entries = find_entries(reflection, vs_entry, fs_entry);
+
+    for (const ReflectedVertexInput& in : entries[0]->inputs) {
+        const auto it = std::ranges::find(vin.attributes, in.location, &VertexInputAttributeDescription::location);
+        if (it == vin.attributes.end()) throw std::runtime_error(std::format("vk.pipeline: vertex input '{}' (location {}) has no matching attribute", in.name, in.location));
+        if (in.format != Format::eUndefined && numeric_class(it->format) != numeric_class(in.format)) {
+            throw std::runtime_error(std::format("vk.pipeline: vertex input '{}' (location {}) is {} but its attribute is {}", in.name, in.location, to_string(in.format), to_string(it->format)));
+        }
+    }
+
+    for (const ReflectedEntryPoint* entry : entries) {
+        for (const std::uint32_t index : entry->bindings) {
+            const ReflectedBinding& b = reflection.bindings[index];
+            if (b.set >= desc.set_layouts.size()) throw std::runtime_error(std::format("vk.pipeline: '{}' uses set {} but the pipeline has {} set layouts", entry->name, b.set, desc.set_layouts.size()));
+        }
+        for (const std::uint32_t index : entry->push_blocks) {
+            const ReflectedPushBlock& p = reflection.push_blocks[index];
+            if (p.offset + p.size > desc.push_constant_bytes || !(desc.push_constant_stages & entry->stage)) {
+                throw std::runtime_error(std::format("vk.pipeline: '{}' reads {} push-constant bytes but the pipeline provides {} for its stage", entry->name, p.offset + p.size, desc.push_constant_stages & entry->stage ? desc.push_constant_bytes : 0u));
+            }
+        }
+    }
+}
+
+std::size_t vk::pipeline::trim(PipelineRegistry& registry) {
+    std::scoped_lock lock{registry.mutex};
+    // Dependents first: pipelines hold their layouts, and layouts their set layouts.
+    std::size_t dropped = std::erase_if(registry.pipelines, [](const auto& kv) { return kv.second.pipeline.use_count() == 1; });
+    dropped += std::erase_if(registry.layouts, [](const auto& kv) { return kv.second.use_count() == 1; });
+    dropped += std::erase_if(registry.set_layouts, [&](const auto& kv) {
+        if (kv.second.use_count() != 1) return false;
+        registry.set_layout_keys.erase(**kv.second);
+        return true;
+    });
+    dropped += std::erase_if(registry.shaders, [](const auto& kv) { return kv.second.module.use_count() == 1; });
+    return dropped;
+}
+
+std::unique_ptr<vk::pipeline::PipelineCompiler> vk::pipeline::create_pipeline_compiler(const raii::Device& device, PipelineRegistry& registry, std::uint32_t threads, const std::uint32_t max_batch) {
+    if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+    auto out       = std::make_unique<PipelineCompiler>();
+    out->device    = &device;
+    out->registry  = &registry;
+    out->max_batch = std::max(max_batch, 1u);
+
+    out->workers.reserve(threads);
+    for (std::uint32_t i = 0; i < threads; ++i) {
+        out->workers.emplace_back([c = out.get(), threads](const std::stop_token stop) { run_compiler(stop, *c, threads); });
+    }
+    return out;
+}
+
+vk::pipeline::PipelineFuture vk::pipeline::compile_async(PipelineCompiler& compiler, PipelineJob job) {
+    if (!job.shader.module) throw std::runtime_error("vk.pipeline: compile_async needs a shader from acquire_shader");
+    if (job.vs_entry.empty() || job.fs_entry.empty()) throw std::runtime_error("vk.pipeline: compile_async needs vertex and fragment entry points");
+    if (job.desc.dynamic_polygon_mode && !compiler.registry->dynamic_polygon_mode) throw std::runtime_error("vk.pipeline: dynamic_polygon_mode needs extendedDynamicState3PolygonMode");
+
+    PipelineKey key{};
+    {
+        std::scoped_lock lock{compiler.registry->mutex};
+        key = make_pipeline_key(make_layout_key(*compiler.registry, job.desc), job.vin, job.desc, job.shader, job.vs_entry, job.fs_entry);
+    }
+
+    // In flight before the registry: a finished job is published to the registry before it
+    // leaves in_flight, so one that completes between the two lookups is still found.
+    {
+        std::scoped_lock lock{compiler.mutex};
+        if (const auto it = compiler.in_flight.find(key); it != compiler.in_flight.end()) {
+            ++compiler.stats.submitted;
+            ++compiler.stats.deduplicated;
+            return PipelineFuture{.future = it->second};
+        }
+    }
+
+    std::optional<SharedPipeline> existing;
+    {
+        std::scoped_lock lock{compiler.registry->mutex};
+        if (const auto it = compiler.registry->pipelines.find(key); it != compiler.registry->pipelines.end()) {
+            ++compiler.registry->stats.pipeline_hits;
+            existing = it->second;
+        }
+    }
+
+    if (!existing && job.shader.reflection) validate_pipeline(*job.shader.reflection, job.vin, job.desc, job.vs_entry.c_str(), job.fs_entry.c_str());
+
+    std::scoped_lock lock{compiler.mutex};
+    ++compiler.stats.submitted;
+    if (existing) {
+        ++compiler.stats.deduplicated;
+        std::promise<SharedPipeline> done;
+        done.set_value(std::move(*existing));
+        return PipelineFuture{.future = done.get_future().share()};
+    }
+    // Another caller may have queued the same key while this one validated.
+    if (const auto it = compiler.in_flight.find(key); it != compiler.in_flight.end()) {
+        ++compiler.stats.deduplicated;
+        return PipelineFuture{.future = it->second};
+    }
+
+    // The vector's buffer survives moves of the job, so the re-pointed span stays valid.
+    auto& queued = compiler.queue.emplace_back();
+    queued.key   = key;
+    queued.set_layouts.assign(job.desc.set_layouts.begin(), job.desc.set_layouts.end());
+    queued.request                  = std::move(job);
+    queued.request.desc.set_layouts = queued.set_layouts;
+
+    auto future = queued.promise.get_future().share();
+    compiler.in_flight.emplace(key, future);
+    compiler.wake.notify_one();
+    return PipelineFuture{.future = std::move(future)};
+}
+
+void vk::pipeline::wait_idle(PipelineCompiler& compiler) {
+    std::unique_lock lock{compiler.mutex};
+    compiler.idle.wait(lock, [&] { return compiler.queue.empty() && compiler.active == 0; });
+}
+
+bool vk::pipeline::ready(const PipelineFuture& future) {
+    return future.future.valid() && future.future.wait_for(std::chrono::seconds{0}) == std::future_status::ready;
+}
+
+vk::Pipeline vk::pipeline::pipeline_or(const PipelineFuture& future, const Pipeline fallback) {
+    if (!ready(future)) return fallback;
+    return **future.future.get().pipeline;
+}
+
+vk::pipeline::PipelineCache vk::pipeline::open_pipeline_cache(const raii::PhysicalDevice& physical_device, const raii::Device& device, std::filesystem::path path) {
+    const auto t0    = std::chrono::steady_clock::now();
+    const auto props = physical_device.getProperties();
+
+    PipelineCache out{};
+    out.path           = std::move(path);
+    out.vendor_id      = props.vendorID;
+    out.device_id      = props.deviceID;
+    out.driver_version = props.driverVersion;
+    std::ranges::copy(props.pipelineCacheUUID, out.uuid.begin());
+
+    const std::vector<std::byte> payload = read_cache_payload(out);
+    const PipelineCacheCreateInfo ci{
+        .initialDataSize = payload.size(),
+        .pInitialData    = payload.empty() ? nullptr : payload.data(),
     };
+    out.cache = raii::PipelineCache{device, ci};
 
-    out.pipeline = raii::Pipeline{device, nullptr, gpi};
+    out.stats.warm         = !payload.empty();
+    out.stats.loaded_bytes = payload.size();
+    out.stats.saved_bytes  = payload.size();
+    out.stats.saved_hash   = payload.empty() ? 0 : fnv1a(payload);
+    out.stats.load_ms      = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
     return out;
 }
+
+void vk::pipeline::save_pipeline_cache(PipelineCache& cache) {
+    if (!*cache.cache || cache.path.empty()) return;
+
+    const auto data = cache.cache.getData();
+    if (data.empty()) return;
+
+    const auto payload = std::as_bytes(std::span{data});
+    const auto hash    = fnv1a(payload);
+    if (data.size() == cache.stats.saved_bytes && hash == cache.stats.saved_hash) return;
+
+    CacheFileHeader h     = expected_header(cache);
+    h.payload_size        = payload.size();
+    h.payload_hash        = hash;
+    const auto tmp        = std::filesystem::path{cache.path}.concat(".tmp");
+    const auto parent_dir = cache.path.parent_path();
+    if (!parent_dir.empty()) std::filesystem::create_directories(parent_dir);
+
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        if (!f) throw std::runtime_error("vk.pipeline: failed to open file: " + tmp.string());
+        f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        f.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+        if (!f) throw std::runtime_error("vk.pipeline: failed to write file: " + tmp.string());
+    }
+    // rename() replaces the destination atomically, so readers never see a partial file.
+    std::filesystem::rename(tmp, cache.path);
+    cache.stats.saved_bytes = data.size();
+    cache.stats.saved_hash  = hash;
+}
@@ -0,0 +1,260 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+module vk.resolution;
+
+import vk.context;
+import vk.frame;
+import vk.memory;
+import vk.swapchain;
+import std;
+
+namespace vk::resolution {
+
+    namespace {
+        struct TargetImage {
+            memory::Allocation allocation{};
+            raii::Image image{nullptr};
+            raii::ImageView view{nullptr};
+        };
+
+        [[nodiscard]] TargetImage create_target_image(const context::VulkanContext& vkctx, const Extent2D extent, const Format format, const ImageUsageFlags usage, const ImageAspectFlags aspect, const uint32_t tag) {
+            TargetImage out{};
+
+            const ImageCreateInfo image_ci{
+                .imageType     = ImageType::e2D,
+                .format        = format,
+                .extent        = Extent3D{extent.width, extent.height, 1},
+                .mipLevels     = 1,
+                .arrayLayers   = 1,
+                .samples       = SampleCountFlagBits::e1,
+                .tiling        = ImageTiling::eOptimal,
+                .usage         = usage,
+                .sharingMode   = SharingMode::eExclusive,
+                .initialLayout = ImageLayout::eUndefined,
+            };
+            out.image      = raii::Image{vkctx.device, image_ci};
+            out.allocation = memory::allocate_for_image(vkctx.allocator, vkctx.device, out.image, MemoryPropertyFlagBits::eDeviceLocal);
+            memory::set_tag(out.allocation, tag);
+
+            const ImageViewCreateInfo view_ci{
+                .image            = *out.image,
+                .viewType         = ImageViewType::e2D,
+                .format           = format,
+                .subresourceRange = ImageSubresourceRange{aspect, 0, 1, 0, 1},
+            };
+            out.view = raii::ImageView{vkctx.device, view_ci};
+            return out;
+        }
+
+        [[nodiscard]] uint32_t scaled_dimension(const uint32_t full, const float scale, const uint32_t granularity) {
+            const uint32_t g = std::max(granularity, 1u);
+            const auto v     = static_cast<uint32_t>(std::lround(static_cast<double>(full) * scale));
+            return std::clamp((v + g - 1) / g * g, std::min(g, full), full);
+        }
+
+        void apply_scale(ScaledTarget& target) {
+            const float s = target.controller.scale;
+            target.extent = Extent2D{scaled_dimension(target.max_extent.width, s, target.granularity), scaled_dimension(target.max_extent.height, s, target.granularity)};
+        }
+
+        void build_images(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, ScaledTarget& target) {
+            const uint32_t tag  = memory::register_tag(vkctx.allocator, "resolution.target");
+            target.max_extent   = sc.extent;
+            target.depth_format = sc.depth_format;
+            target.depth_aspect = sc.depth_aspect;
+
+            auto color = create_target_image(vkctx, sc.extent, target.color_format, ImageUsageFlagBits::eColorAttachment | ImageUsageFlagBits::eTransferSrc | ImageUsageFlagBits::eTransferDst | ImageUsageFlagBits::eSampled, ImageAspectFlagBits::eColor, tag);
+            target.color_allocation = std::move(color.allocation);
+            target.color_image      = std::move(color.image);
+            target.color_view       = std::move(color.view);
+            target.color_layout     = ImageLayout::eUndefined;
+
+            auto depth = create_target_image(vkctx, sc.extent, sc.depth_format, ImageUsageFlagBits::eDepthStencilAttachment | ImageUsageFlagBits::eSampled, sc.depth_aspect, tag);
+            target.depth_allocation = std::move(depth.allocation);
+            target.depth_image      = std::move(depth.image);
+            target.depth_view       = std::move(depth.view);
+            target.depth_layout     = ImageLayout::eUndefined;
+
+            apply_scale(target);
+        }
+    } // namespace
+
+    ScaledTarget create_scaled_target(const context::VulkanContext& vkctx, const swapchain::Swapchain& sc, const ScaledTargetDesc& desc) {
+        ScaledTarget out{};
+        out.granularity      = std::max(desc.granularity, 1u);
+        out.controller       = desc.controller;
+        out.controller.scale = std::clamp(out.controller.scale, out.controller.min_scale, out.controller.max_scale);
+        out.color_format     = desc.color_format == Format::eUndefined ? sc.format : desc.color_format;
+
+        const auto props = vkctx.physical_device.getFormatProperties(out.color_format).optimalTilingFeatures;
+        if (!(props & FormatFeatureFlagBits::eBlitSrc) || !(props & FormatFeatureFlagBits::eSampledImageFilterLinear)) throw std::runtime_error("vk.resolution: color format does not support linear blits");
+
+        // record_upscale blits straight into the swapchain image.
+        if (!(sc.usage & ImageUsageFlagBits::eTransferDst)) throw std::runtime_error("vk.resolution: swapchain images do not support transfer dst usage");
+        const auto sc_props = vkctx.physical_device.getFormatProperties(sc.format).optimalTilingFeatures;
+        if (!(sc_props & FormatFeatureFlagBits::eBlitDst)) throw std::runtime_error("vk.resolution: swapchain format does not support blit dst");
+
+        build_images(vkctx, sc, out);
+        return out;
+    }
+
+    void on_swapchain_recreated(const context::VulkanContext& vkctx, frame::FrameSystem& frames, const swapchain::Swapchain& sc, ScaledTarget& target) {
+        ScaledTarget old{};
+        old.color_allocation = std::move(target.color_allocation);
+        old.color_image      = std::move(target.color_image);
+        old.color_view       = std::move(target.color_view);
+        old.depth_allocation = std::move(target.depth_allocation);
+        old.depth_image      = std::move(target.depth_image);
+        old.depth_view       = std::move(target.depth_view);
+        frame::retire(frames, std::move(old));
+
+        build_images(vkctx, sc, target);
+    }
+
+    float update_scale(ScaledTarget& target, const float gpu_ms) {
+        auto& c = target.controller;
+        if (!(gpu_ms > 0.0f) || !(c.target_ms > 0.0f)) return c.scale;
+
+        c.filtered_ms = c.filtered_ms > 0.0f ? c.filtered_ms + (gpu_ms - c.filtered_ms) * c.smoothing : gpu_ms;
+        if (c.cooldown > 0) {
+            --c.cooldown;
+            return c.scale;
+        }
+
+        c.error = (c.target_ms - c.filtered_ms) / c.target_ms; // > 0: headroom, scale up
+        if (std::abs(c.error) < c.deadband) return c.scale;
+
+        const float integral = std::clamp(c.integral + c.error, -4.0f, 4.0f);
+        const float area     = c.scale * c.scale * std::max(1.0f + c.kp * c.error + c.ki * integral, 0.05f);
+        const float next     = std::clamp(std::sqrt(area), c.min_scale, c.max_scale);
+        // Anti-windup: stop integrating while pinned at a limit.
+        if (next > c.min_scale && next < c.max_scale) c.integral = integral;
+
+        const Extent2D before = target.extent;
+        c.scale               = next;
+        apply_scale(target);
+        if (target.extent != before) c.cooldown = c.settle_frames;
+        return c.scale;
+    }
+
+    bool update_scale(ScaledTarget& target, const frame::FrameSystem& frames, const std::string_view scope) {
+        for (const auto& r : frame::gpu_timings(frames)) {
+            if (r.name != scope || r.ms <= 0.0) continue;
+            update_scale(target, static_cast<float>(r.ms));
+            return true;
+        }
+        return false;
+    }
+
+    Viewport viewport(const ScaledTarget& target) {
+        return Viewport{0.0f, 0.0f, static_cast<float>(target.extent.width), static_cast<float>(target.extent.height), 0.0f, 1.0f};
+    }
+
+    Rect2D scissor(const ScaledTarget& target) {
+        return Rect2D{Offset2D{0, 0}, target.extent};
+    }
+
+    std::array<float, 2> uv_scale(const ScaledTarget& target) {
+        return {
+            static_cast<float>(target.extent.width) / static_cast<float>(target.max_extent.width),
+            static_cast<float>(target.extent.height) / static_cast<float>(target.max_extent.height),
+        };
+    }
+
+    void record_upscale(const raii::CommandBuffer& cmd, ScaledTarget& target, const Image dst, ImageLayout& dst_layout, const Extent2D dst_extent, const ImageLayout final_layout) {
+        constexpr ImageSubresourceRange color{ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+        constexpr ImageSubresourceLayers layers{ImageAspectFlagBits::eColor, 0, 0, 1};
+
+        // The source is both read and written (edge replication below), so it goes to eGeneral.
+        // The blit overwrites all of dst, so its previous contents are discarded.
+        const std::array to_transfer{
+            ImageMemoryBarrier2{
+                .srcStageMask     = PipelineStageFlagBits2::eColorAttachmentOutput,
+                .srcAccessMask    = AccessFlagBits2::eColorAttachmentWrite,
+                .dstStageMask     = PipelineStageFlagBits2::eCopy | PipelineStageFlagBits2::eBlit,
+                .dstAccessMask    = AccessFlagBits2::eTransferRead | AccessFlagBits2::eTransferWrite,
+                .oldLayout        = target.color_layout,
+                .newLayout        = ImageLayout::eGeneral,
+                .image            = *target.color_image,
+                .subresourceRange = color,
+            },
+            ImageMemoryBarrier2{
+                .srcStageMask     = PipelineStageFlagBits2::eAllCommands,
+                .srcAccessMask    = AccessFlagBits2::eNone,
+                .dstStageMask     = PipelineStageFlagBits2::eBlit,
+                .dstAccessMask    = AccessFlagBits2::eTransferWrite,
+                .oldLayout        = ImageLayout::eUndefined,
+                .newLayout        = ImageLayout::eTransferDstOptimal,
+                .image            = dst,
+                .subresourceRange = color,
+            },
+        };
+        cmd.pipelineBarrier2(DependencyInfo{.imageMemoryBarrierCount = static_cast<uint32_t>(to_transfer.size()), .pImageMemoryBarriers = to_transfer.data()});
+
+        // Linear filtering reads one texel past the rendered rect. Replicate its last column and row
+        // there, so stale texels from an earlier, larger extent do not bleed into the edge.
+        const auto copy_edge = [&](const Offset3D src, const Offset3D dst, const Extent3D size) {
+            const ImageCopy2 region{
+                .srcSubresource = layers,
+                .srcOffset      = src,
+                .dstSubresource = layers,
+                .dstOffset      = dst,
+                .extent         = size,
+            };
+            cmd.copyImage2(CopyImageInfo2{
+                .srcImage       = *target.color_image,
+                .srcImageLayout = ImageLayout::eGeneral,
+                .dstImage       = *target.color_image,
+                .dstImageLayout = ImageLayout::eGeneral,
+                .regionCount    = 1,
+                .pRegions       = &region,
+            });
+            const MemoryBarrier2 written{
+                .srcStageMask  = PipelineStageFlagBits2::eCopy,
+                .srcAccessMask = AccessFlagBits2::eTransferWrite,
+                .dstStageMask  = PipelineStageFlagBits2::eCopy | PipelineStageFlagBits2::eBlit,
+                .dstAccessMask = AccessFlagBits2::eTransferRead,
+            };
+            cmd.pipelineBarrier2(DependencyInfo{.memoryBarrierCount = 1, .pMemoryBarriers = &written});
+        };
+        const auto w     = static_cast<int32_t>(target.extent.width);
+        const auto h     = static_cast<int32_t>(target.extent.height);
+        const bool pad_x = target.extent.width < target.max_extent.width;
+        const bool pad_y = target.extent.height < target.max_extent.height;
+        if (pad_x) copy_edge(Offset3D{w - 1, 0, 0}, Offset3D{w, 0, 0}, Extent3D{1, target.extent.height, 1});
+        if (pad_y) copy_edge(Offset3D{0, h - 1, 0}, Offset3D{0, h, 0}, Extent3D{target.extent.width + (pad_x ? 1u : 0u), 1, 1});
+
+        const ImageBlit2 region{
+            .srcSubresource = layers,
+            .srcOffsets     = std::array{Offset3D{0, 0, 0}, Offset3D{static_cast<int32_t>(target.extent.width), static_cast<int32_t>(target.extent.height), 1}},
+            .dstSubresource = layers,
+            .dstOffsets     = std::array{Offset3D{0, 0, 0}, Offset3D{static_cast<int32_t>(dst_extent.width), static_cast<int32_t>(dst_extent.height), 1}},
+        };
+        cmd.blitImage2(BlitImageInfo2{
+            .srcImage       = *target.color_image,
+            .srcImageLayout = ImageLayout::eGeneral,
+            .dstImage       = dst,
+            .dstImageLayout = ImageLayout::eTransferDstOptimal,
+            .regionCount    = 1,
+            .pRegions       = &region,
+            .filter         = Filter::eLinear,
+        });
+
+        const bool attachment = final_layout == ImageLayout::eColorAttachmentOptimal;
+        const ImageMemoryBarrier2 to_final{
+            .srcStageMask     = PipelineStageFlagBits2::eBlit,
+            .srcAccessMask    = AccessFlagBits2::eTransferWrite,
+            .dstStageMask     = attachment ? PipelineStageFlagBits2::eColorAttachmentOutput : PipelineStageFlagBits2::eAllCommands,
+            .dstAccessMask    = attachment ? AccessFlagBits2::eColorAttachmentRead | AccessFlagBits2::eColorAttachmentWrite : AccessFlagBits2::eMemoryRead | AccessFlagBits2::eMemoryWrite,
+            .oldLayout        = ImageLayout::eTransferDstOptimal,
+            .newLayout        = final_layout,
+            .image            = dst,
+            .subresourceRange = color,
+        };
+        cmd.pipelineBarrier2(DependencyInfo{.imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &to_final});
+
+        target.color_layout = ImageLayout::eGeneral;
+        dst_layout          = final_layout;
+    }
+
+} // namespace vk::resolution
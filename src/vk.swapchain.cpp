@@ -5,6 +5,7 @@ module;
 #include <vulkan/vulkan_raii.hpp>
 module vk.swapchain;
 import vk.context;
+import vk.memory;
 import std;
 
 
@@ -32,14 +33,19 @@ namespace {
         return formats.front();
     }
 
-    [[nodiscard]] vk::PresentModeKHR choose_present_mode(const std::span<const vk::PresentModeKHR> modes) {
-        for (const auto m : modes) {
-            if (m == vk::PresentModeKHR::eMailbox) return m;
-        }
-        for (const auto m : modes) {
-            if (m == vk::PresentModeKHR::eImmediate) return m;
+    [[nodiscard]] vk::PresentModeKHR choose_present_mode(const std::span<const vk::PresentModeKHR> modes, const vk::swapchain::PresentConfig& cfg) {
+        using enum vk::PresentModeKHR;
+        const auto has = [&](const vk::PresentModeKHR m) { return std::ranges::find(modes, m) != modes.end(); };
+
+        // FIFO is the only mode every surface supports, so it ends each preference list.
+        vk::PresentModeKHR mode = eFifo;
+        switch (cfg.policy) {
+        case vk::swapchain::PresentPolicy::LowLatency: mode = has(eMailbox) ? eMailbox : has(eImmediate) ? eImmediate : eFifo; break;
+        case vk::swapchain::PresentPolicy::TearFree: mode = has(eMailbox) ? eMailbox : eFifo; break;
+        case vk::swapchain::PresentPolicy::LowPower: mode = eFifo; break;
         }
-        return vk::PresentModeKHR::eFifo;
+        if (mode == eFifo && cfg.allow_fifo_relaxed && has(eFifoRelaxed)) mode = eFifoRelaxed;
+        return mode;
     }
 
     [[nodiscard]] vk::Extent2D choose_extent(const vk::SurfaceCapabilitiesKHR& caps, const vk::Extent2D requested) {
@@ -52,9 +58,12 @@ namespace {
         };
     }
 
-    [[nodiscard]] uint32_t choose_image_count(const vk::SurfaceCapabilitiesKHR& caps) {
-        uint32_t count = caps.minImageCount + 1;
-        if (count < 2) count = 2;
+    // LowPower keeps the queue short (double buffering); the other policies add one image so
+    // the CPU rarely blocks on acquire.
+    [[nodiscard]] uint32_t choose_image_count(const vk::SurfaceCapabilitiesKHR& caps, const vk::swapchain::PresentConfig& cfg) {
+        uint32_t count = cfg.image_count;
+        if (count == 0) count = cfg.policy == vk::swapchain::PresentPolicy::LowPower ? caps.minImageCount : caps.minImageCount + 1;
+        count = std::max({count, caps.minImageCount, 2u});
         if (caps.maxImageCount && count > caps.maxImageCount) count = caps.maxImageCount;
         return count;
     }
@@ -104,16 +113,6 @@ namespace {
         return out;
     }
 
-    [[nodiscard]] uint32_t find_memory_type(const vk::raii::PhysicalDevice& pd, const uint32_t type_bits, const vk::MemoryPropertyFlags props) {
-        const auto mp = pd.getMemoryProperties();
-        for (uint32_t i = 0; i < mp.memoryTypeCount; ++i) {
-            const bool ok_bits  = (type_bits & (1u << i)) != 0;
-            const bool ok_props = (mp.memoryTypes[i].propertyFlags & props) == props;
-            if (ok_bits && ok_props) return i;
-        }
-        throw std::runtime_error("No suitable memory type found");
-    }
-
     [[nodiscard]] bool supports_depth_attachment(const vk::raii::PhysicalDevice& pd, const vk::Format fmt) {
         const auto p = pd.getFormatProperties(fmt);
         return (p.optimalTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment) != vk::FormatFeatureFlags{};
@@ -140,12 +139,18 @@ namespace {
     }
 
     struct DepthResources {
+        vk::memory::Allocation allocation{};
         vk::raii::Image image{nullptr};
-        vk::raii::DeviceMemory memory{nullptr};
         vk::raii::ImageView view{nullptr};
     };
 
-    [[nodiscard]] DepthResources create_depth_resources(const vk::raii::Device& device, const vk::raii::PhysicalDevice& pd, const vk::Extent2D extent, const vk::Format format, const vk::ImageAspectFlags aspect) {
+    // The old chain's depth memory is taken over when the new image fits in it. Callers pass it
+    // only once no submitted work still uses the old depth image.
+    [[nodiscard]] bool fits(const vk::memory::Allocation& a, const vk::MemoryRequirements& req) {
+        return a.memory && req.size <= a.size && a.offset % req.alignment == 0 && (req.memoryTypeBits & (1u << a.memory_type)) != 0;
+    }
+
+    [[nodiscard]] DepthResources create_depth_resources(const vk::raii::Device& device, const vk::memory::Allocator& allocator, const vk::Extent2D extent, const vk::Format format, const vk::ImageAspectFlags aspect, vk::memory::Allocation* reuse) {
         DepthResources out{};
 
         vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
@@ -165,15 +170,13 @@ namespace {
         };
 
         out.image = vk::raii::Image{device, image_ci};
-
-        const vk::MemoryRequirements req = out.image.getMemoryRequirements();
-        const vk::MemoryAllocateInfo alloc_ci{
-            .allocationSize  = req.size,
-            .memoryTypeIndex = find_memory_type(pd, req.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal),
-        };
-
-        out.memory = vk::raii::DeviceMemory{device, alloc_ci};
-        out.image.bindMemory(*out.memory, 0);
+        if (reuse && fits(*reuse, out.image.getMemoryRequirements())) {
+            out.allocation = std::move(*reuse);
+            out.image.bindMemory(out.allocation.memory, out.allocation.offset);
+        } else {
+            out.allocation = vk::memory::allocate_for_image(allocator, device, out.image, vk::MemoryPropertyFlagBits::eDeviceLocal);
+            vk::memory::set_tag(out.allocation, vk::memory::register_tag(allocator, "swapchain.depth"));
+        }
 
         const vk::ImageViewCreateInfo view_ci{
             .image            = *out.image,
@@ -187,6 +190,35 @@ namespace {
         return out;
     }
 
+    void create_image_views(const vk::raii::Device& device, vk::swapchain::Swapchain& sc) {
+        sc.image_views.clear();
+        sc.image_views.reserve(sc.images.size());
+
+        vk::ImageViewCreateInfo ivci{
+            .image            = VK_NULL_HANDLE,
+            .viewType         = vk::ImageViewType::e2D,
+            .format           = sc.format,
+            .components       = vk::ComponentMapping{},
+            .subresourceRange = vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
+        };
+
+        for (auto img : sc.images) {
+            ivci.image = img;
+            sc.image_views.emplace_back(device, ivci);
+        }
+    }
+
+    void create_depth(const vk::context::VulkanContext& vkctx, vk::swapchain::Swapchain& sc, vk::memory::Allocation* reuse = nullptr) {
+        sc.depth_format = choose_depth_format(vkctx.physical_device);
+        sc.depth_aspect = depth_aspect(sc.depth_format);
+
+        auto [allocation, image, view] = create_depth_resources(vkctx.device, vkctx.allocator, sc.extent, sc.depth_format, sc.depth_aspect, reuse);
+        sc.depth_allocation            = std::move(allocation);
+        sc.depth_image                 = std::move(image);
+        sc.depth_view                  = std::move(view);
+        sc.depth_layout                = vk::ImageLayout::eUndefined;
+    }
+
     [[nodiscard]] vk::Extent2D wait_nonzero_framebuffer_extent(GLFWwindow* w) {
         int fbw = 0;
         int fbh = 0;
@@ -197,100 +229,125 @@ namespace {
         return vk::Extent2D{static_cast<uint32_t>(fbw), static_cast<uint32_t>(fbh)};
     }
 
-} // namespace
+    [[nodiscard]] vk::swapchain::Swapchain build_swapchain(const vk::context::VulkanContext& vkctx, const vk::context::SurfaceContext& sctx, const vk::swapchain::Swapchain* old, vk::memory::Allocation* reuse_depth, const vk::swapchain::PresentConfig& present) {
+        const auto caps  = vkctx.physical_device.getSurfaceCapabilitiesKHR(*sctx.surface);
+        const auto fmts  = vkctx.physical_device.getSurfaceFormatsKHR(*sctx.surface);
+        const auto modes = vkctx.physical_device.getSurfacePresentModesKHR(*sctx.surface);
+
+        if (fmts.empty()) throw std::runtime_error("Surface has no formats");
+        if (modes.empty()) throw std::runtime_error("Surface has no present modes");
+
+        const auto [format, colorSpace] = choose_surface_format(fmts);
+        const auto present_mode         = choose_present_mode(modes, present);
+        const auto extent               = choose_extent(caps, sctx.extent);
+
+        if (extent.width == 0 || extent.height == 0) throw std::runtime_error("Cannot create swapchain with zero extent");
+
+        const auto image_count = choose_image_count(caps, present);
+        const auto usage       = choose_swapchain_usage(caps);
+
+        const auto composite = choose_composite_alpha(caps);
+        const auto transform = choose_pre_transform(caps);
+
+        const uint32_t graphics_q         = vkctx.graphics_queue_index;
+        const uint32_t present_q          = vkctx.graphics_queue_index;
+        const auto [mode, indices, count] = choose_sharing(graphics_q, present_q);
+
+        vk::SwapchainCreateInfoKHR ci{
+            .surface          = *sctx.surface,
+            .minImageCount    = image_count,
+            .imageFormat      = format,
+            .imageColorSpace  = colorSpace,
+            .imageExtent      = extent,
+            .imageArrayLayers = 1,
+            .imageUsage       = usage,
+            .imageSharingMode = mode,
+            .preTransform     = transform,
+            .compositeAlpha   = composite,
+            .presentMode      = present_mode,
+            .clipped          = VK_TRUE,
+            .oldSwapchain     = old ? *old->handle : VK_NULL_HANDLE,
+        };
 
-vk::swapchain::Swapchain vk::swapchain::setup_swapchain(const context::VulkanContext& vkctx, const context::SurfaceContext& sctx, const Swapchain* old) {
-    const auto caps  = vkctx.physical_device.getSurfaceCapabilitiesKHR(*sctx.surface);
-    const auto fmts  = vkctx.physical_device.getSurfaceFormatsKHR(*sctx.surface);
-    const auto modes = vkctx.physical_device.getSurfacePresentModesKHR(*sctx.surface);
-
-    if (fmts.empty()) throw std::runtime_error("Surface has no formats");
-    if (modes.empty()) throw std::runtime_error("Surface has no present modes");
-
-    const auto [format, colorSpace] = choose_surface_format(fmts);
-    const auto present_mode         = choose_present_mode(modes);
-    const auto extent               = choose_extent(caps, sctx.extent);
-
-    if (extent.width == 0 || extent.height == 0) throw std::runtime_error("Cannot create swapchain with zero extent");
-
-    const auto image_count = choose_image_count(caps);
-    const auto usage       = choose_swapchain_usage(caps);
-
-    const auto composite = choose_composite_alpha(caps);
-    const auto transform = choose_pre_transform(caps);
-
-    const uint32_t graphics_q         = vkctx.graphics_queue_index;
-    const uint32_t present_q          = vkctx.graphics_queue_index;
-    const auto [mode, indices, count] = choose_sharing(graphics_q, present_q);
-
-    SwapchainCreateInfoKHR ci{
-        .surface          = *sctx.surface,
-        .minImageCount    = image_count,
-        .imageFormat      = format,
-        .imageColorSpace  = colorSpace,
-        .imageExtent      = extent,
-        .imageArrayLayers = 1,
-        .imageUsage       = usage,
-        .imageSharingMode = mode,
-        .preTransform     = transform,
-        .compositeAlpha   = composite,
-        .presentMode      = present_mode,
-        .clipped          = VK_TRUE,
-        .oldSwapchain     = old ? *old->handle : VK_NULL_HANDLE,
-    };
+        if (count) {
+            ci.queueFamilyIndexCount = count;
+            ci.pQueueFamilyIndices   = indices.data();
+        }
+
+        vk::swapchain::Swapchain sc{};
 
-    if (count) {
-        ci.queueFamilyIndexCount = count;
-        ci.pQueueFamilyIndices   = indices.data();
+        sc.handle       = vk::raii::SwapchainKHR{vkctx.device, ci};
+        sc.images       = sc.handle.getImages();
+        sc.format       = format;
+        sc.color_space  = colorSpace;
+        sc.extent       = extent;
+        sc.usage        = usage;
+        sc.present      = present;
+        sc.present_mode = present_mode;
+
+        create_image_views(vkctx.device, sc);
+        create_depth(vkctx, sc, reuse_depth);
+
+        return sc;
     }
 
-    Swapchain sc{};
+} // namespace
 
-    sc.handle      = raii::SwapchainKHR{vkctx.device, ci};
-    sc.images      = sc.handle.getImages();
-    sc.format      = format;
-    sc.color_space = colorSpace;
-    sc.extent      = extent;
+vk::swapchain::Swapchain vk::swapchain::setup_swapchain(const context::VulkanContext& vkctx, const context::SurfaceContext& sctx, const Swapchain* old, const PresentConfig& present) {
+    return build_swapchain(vkctx, sctx, old, nullptr, present);
+}
 
-    sc.image_views.clear();
-    sc.image_views.reserve(sc.images.size());
+vk::swapchain::Swapchain vk::swapchain::setup_offscreen(const context::VulkanContext& vkctx, const Extent2D extent, const uint32_t image_count, const Format format) {
+    if (extent.width == 0 || extent.height == 0) throw std::runtime_error("Cannot create offscreen chain with zero extent");
+    if (image_count == 0) throw std::runtime_error("Offscreen chain needs at least one image");
 
-    ImageViewCreateInfo ivci{
-        .image            = VK_NULL_HANDLE,
-        .viewType         = ImageViewType::e2D,
-        .format           = sc.format,
-        .components       = ComponentMapping{},
-        .subresourceRange = ImageSubresourceRange{ImageAspectFlagBits::eColor, 0, 1, 0, 1},
+    Swapchain sc{};
+    sc.format      = format;
+    sc.color_space = ColorSpaceKHR::eSrgbNonlinear;
+    sc.extent      = extent;
+    sc.usage       = ImageUsageFlagBits::eColorAttachment | ImageUsageFlagBits::eTransferSrc | ImageUsageFlagBits::eTransferDst | ImageUsageFlagBits::eSampled;
+
+    const ImageCreateInfo image_ci{
+        .imageType     = ImageType::e2D,
+        .format        = format,
+        .extent        = Extent3D{extent.width, extent.height, 1},
+        .mipLevels     = 1,
+        .arrayLayers   = 1,
+        .samples       = SampleCountFlagBits::e1,
+        .tiling        = ImageTiling::eOptimal,
+        .usage         = sc.usage,
+        .sharingMode   = SharingMode::eExclusive,
+        .initialLayout = ImageLayout::eUndefined,
     };
 
-    for (auto img : sc.images) {
-        ivci.image = img;
-        sc.image_views.emplace_back(vkctx.device, ivci);
+    const uint32_t tag = memory::register_tag(vkctx.allocator, "offscreen.color");
+    sc.offscreen_allocations.reserve(image_count);
+    sc.offscreen_images.reserve(image_count);
+    for (uint32_t i = 0; i < image_count; ++i) {
+        sc.offscreen_images.emplace_back(vkctx.device, image_ci);
+        sc.offscreen_allocations.push_back(memory::allocate_for_image(vkctx.allocator, vkctx.device, sc.offscreen_images.back(), MemoryPropertyFlagBits::eDeviceLocal));
+        memory::set_tag(sc.offscreen_allocations.back(), tag);
+        sc.images.push_back(*sc.offscreen_images.back());
     }
 
-    sc.depth_format = choose_depth_format(vkctx.physical_device);
-    sc.depth_aspect = depth_aspect(sc.depth_format);
-
-    {
-        auto [image, memory, view] = create_depth_resources(vkctx.device, vkctx.physical_device, sc.extent, sc.depth_format, sc.depth_aspect);
-        sc.depth_image             = std::move(image);
-        sc.depth_memory            = std::move(memory);
-        sc.depth_view              = std::move(view);
-        sc.depth_layout            = ImageLayout::eUndefined;
-    }
+    create_image_views(vkctx.device, sc);
+    create_depth(vkctx, sc);
 
     return sc;
 }
 
-void vk::swapchain::recreate_swapchain(const context::VulkanContext& vkctx, context::SurfaceContext& sctx, Swapchain& sc) {
-    const auto extent = wait_nonzero_framebuffer_extent(sctx.window.get());
+bool vk::swapchain::is_offscreen(const Swapchain& sc) {
+    return !*sc.handle;
+}
 
-    vkctx.device.waitIdle();
+vk::swapchain::Swapchain vk::swapchain::recreate_swapchain(const context::VulkanContext& vkctx, context::SurfaceContext& sctx, Swapchain& sc, const bool reuse_depth) {
+    const auto extent = wait_nonzero_framebuffer_extent(sctx.window.get());
 
     sctx.extent = extent;
 
-    const Swapchain old = std::move(sc);
-    sc                  = setup_swapchain(vkctx, sctx, &old);
+    Swapchain old = std::move(sc);
+    sc            = build_swapchain(vkctx, sctx, &old, reuse_depth ? &old.depth_allocation : nullptr, old.present);
 
     sctx.resize_requested = false;
+    return old;
 }
@@ -2,6 +2,7 @@ module;
 #include <vulkan/vulkan_raii.hpp>
 module vk.texture;
 import vk.context;
+import vk.memory;
 import std;
 
 namespace vk::texture {
@@ -16,52 +17,12 @@ namespace vk::texture {
         return levels;
     }
 
-    static uint32_t find_memory_type(const raii::PhysicalDevice& pd, uint32_t type_bits, MemoryPropertyFlags props) {
-        const auto mp = pd.getMemoryProperties();
-        for (uint32_t i = 0; i < mp.memoryTypeCount; ++i) {
-            const bool ok_bits  = (type_bits & (1u << i)) != 0;
-            const bool ok_props = (mp.memoryTypes[i].propertyFlags & props) == props;
-            if (ok_bits && ok_props) return i;
-        }
-        throw std::runtime_error("vk.texture: no suitable memory type");
-    }
-
-    struct BufferWithMemory {
-        raii::Buffer buffer{nullptr};
-        raii::DeviceMemory memory{nullptr};
-        DeviceSize size = 0;
-    };
-
-    static BufferWithMemory create_buffer(const raii::PhysicalDevice& pd, const raii::Device& dev, DeviceSize size, BufferUsageFlags usage, MemoryPropertyFlags props) {
-        BufferWithMemory out{};
-        out.size = size;
-
-        BufferCreateInfo bci{};
-        bci.size        = size;
-        bci.usage       = usage;
-        bci.sharingMode = SharingMode::eExclusive;
-
-        out.buffer = raii::Buffer{dev, bci};
-
-        const auto req    = out.buffer.getMemoryRequirements();
-        const uint32_t mt = find_memory_type(pd, req.memoryTypeBits, props);
-
-        MemoryAllocateInfo mai{};
-        mai.allocationSize  = req.size;
-        mai.memoryTypeIndex = mt;
-
-        out.memory = raii::DeviceMemory{dev, mai};
-        out.buffer.bindMemory(*out.memory, 0);
-
-        return out;
-    }
-
     struct ImageWithMemory {
+        memory::Allocation allocation{};
         raii::Image image{nullptr};
-        raii::DeviceMemory memory{nullptr};
     };
 
-    static ImageWithMemory create_image_2d(const raii::PhysicalDevice& pd, const raii::Device& dev, uint32_t w, uint32_t h, uint32_t mip_levels, uint32_t layers, Format format, ImageUsageFlags usage) {
+    static ImageWithMemory create_image_2d(const memory::Allocator& allocator, const raii::Device& dev, uint32_t w, uint32_t h, uint32_t mip_levels, uint32_t layers, Format format, ImageUsageFlags usage) {
         ImageWithMemory out{};
 
         ImageCreateInfo ici{};
@@ -76,46 +37,43 @@ namespace vk::texture {
         ici.sharingMode   = SharingMode::eExclusive;
         ici.initialLayout = ImageLayout::eUndefined;
 
-        out.image = raii::Image{dev, ici};
-
-        const auto req    = out.image.getMemoryRequirements();
-        const uint32_t mt = find_memory_type(pd, req.memoryTypeBits, MemoryPropertyFlagBits::eDeviceLocal);
-
-        MemoryAllocateInfo mai{};
-        mai.allocationSize  = req.size;
-        mai.memoryTypeIndex = mt;
-
-        out.memory = raii::DeviceMemory{dev, mai};
-        out.image.bindMemory(*out.memory, 0);
+        out.image      = raii::Image{dev, ici};
+        out.allocation = memory::allocate_for_image(allocator, dev, out.image, MemoryPropertyFlagBits::eDeviceLocal);
+        memory::set_tag(out.allocation, memory::register_tag(allocator, "texture"));
 
         return out;
     }
 
-    static raii::CommandBuffer begin_one_time(const raii::Device& dev, const raii::CommandPool& pool) {
-        CommandBufferAllocateInfo ai{};
-        ai.commandPool        = *pool;
-        ai.level              = CommandBufferLevel::ePrimary;
-        ai.commandBufferCount = 1;
-
-        raii::CommandBuffers cbs{dev, ai};
-        raii::CommandBuffer cmd = std::move(cbs.front());
-
-        CommandBufferBeginInfo bi{};
-        bi.flags = CommandBufferUsageFlagBits::eOneTimeSubmit;
-        cmd.begin(bi);
-        return cmd;
-    }
-
-    static void end_one_time(const raii::Queue& q, raii::CommandBuffer& cmd) {
-        cmd.end();
-
-        SubmitInfo si{};
-        si.commandBufferCount   = 1;
-        const CommandBuffer raw = *cmd;
-        si.pCommandBuffers      = &raw;
-
-        q.submit(si);
-        q.waitIdle();
+    // Copies tightly packed rgba8 layers into `image` through the context's staging ring,
+    // recording into the context's transfer batch. Rows are chunked so images larger than
+    // the ring still upload; the batcher submits early whenever the ring is full.
+    static void stage_rgba8_layers(context::VulkanContext& vkctx, Image image, std::span<const std::byte> rgba8, uint32_t width, uint32_t height, uint32_t layers) {
+        const DeviceSize row_bytes    = DeviceSize(width) * 4u;
+        const DeviceSize max_chunk    = std::max(vkctx.staging.capacity / 2, row_bytes);
+        const uint32_t rows_per_chunk = uint32_t(std::clamp<DeviceSize>(max_chunk / row_bytes, 1, height));
+        const DeviceSize layer_stride = row_bytes * height;
+
+        for (uint32_t layer = 0; layer < layers; ++layer) {
+            for (uint32_t row = 0; row < height; row += rows_per_chunk) {
+                const uint32_t rows = std::min(rows_per_chunk, height - row);
+                const auto chunk    = rgba8.subspan(size_t(layer_stride * layer + row_bytes * row), size_t(row_bytes * rows));
+                const auto slice    = memory::stage_for_batch(vkctx.transfer, vkctx.staging, vkctx.device, vkctx.graphics_queue, chunk, 4);
+
+                BufferImageCopy bic{};
+                bic.bufferOffset                    = slice.offset;
+                bic.bufferRowLength                 = 0;
+                bic.bufferImageHeight               = 0;
+                bic.imageSubresource.aspectMask     = ImageAspectFlagBits::eColor;
+                bic.imageSubresource.mipLevel       = 0;
+                bic.imageSubresource.baseArrayLayer = layer;
+                bic.imageSubresource.layerCount     = 1;
+                bic.imageOffset                     = Offset3D{0, int32_t(row), 0};
+                bic.imageExtent                     = Extent3D{width, rows, 1};
+
+                memory::batch_cmd(vkctx.transfer, vkctx.device).copyBufferToImage(slice.buffer, image, ImageLayout::eTransferDstOptimal, bic);
+                ++vkctx.transfer.recorded_ops;
+            }
+        }
     }
 
     static void barrier_image(const raii::CommandBuffer& cmd, Image image, ImageAspectFlags aspect, uint32_t base_mip, uint32_t mip_count, uint32_t base_layer, uint32_t layer_count, ImageLayout old_layout, ImageLayout new_layout, PipelineStageFlags2 src_stage, AccessFlags2 src_access, PipelineStageFlags2 dst_stage, AccessFlags2 dst_access) {
@@ -201,7 +159,7 @@ namespace vk::texture {
         return raii::Sampler{dev, sci};
     }
 
-    Texture2D create_texture_2d_rgba8(const context::VulkanContext& vkctx, std::span<const std::byte> rgba8, Texture2DDesc desc) {
+    Texture2D create_texture_2d_rgba8(context::VulkanContext& vkctx, std::span<const std::byte> rgba8, Texture2DDesc desc) {
         if (desc.width == 0 || desc.height == 0) throw std::runtime_error("vk.texture: invalid extent");
         if (desc.layers != 1) throw std::runtime_error("vk.texture: create_texture_2d_rgba8 expects layers == 1");
         const size_t expected = size_t(desc.width) * size_t(desc.height) * size_t(desc.layers) * 4u;
@@ -217,37 +175,16 @@ namespace vk::texture {
             }
         }
 
-        const DeviceSize upload_size = DeviceSize(rgba8.size_bytes());
-
-        auto staging = create_buffer(vkctx.physical_device, vkctx.device, upload_size, BufferUsageFlagBits::eTransferSrc, MemoryPropertyFlagBits::eHostVisible | MemoryPropertyFlagBits::eHostCoherent);
-
-        {
-            void* dst = staging.memory.mapMemory(0, upload_size);
-            std::memcpy(dst, rgba8.data(), rgba8.size_bytes());
-            staging.memory.unmapMemory();
-        }
-
         ImageUsageFlags usage = ImageUsageFlagBits::eTransferDst | ImageUsageFlagBits::eSampled;
         if (mip_levels > 1) usage |= ImageUsageFlagBits::eTransferSrc;
 
-        auto img = create_image_2d(vkctx.physical_device, vkctx.device, desc.width, desc.height, mip_levels, desc.layers, format, usage);
-
-        auto cmd = begin_one_time(vkctx.device, vkctx.command_pool);
+        auto img = create_image_2d(vkctx.allocator, vkctx.device, desc.width, desc.height, mip_levels, desc.layers, format, usage);
 
-        barrier_image(cmd, *img.image, ImageAspectFlagBits::eColor, 0, mip_levels, 0, 1, ImageLayout::eUndefined, ImageLayout::eTransferDstOptimal, PipelineStageFlagBits2::eTopOfPipe, AccessFlags2{}, PipelineStageFlagBits2::eTransfer, AccessFlagBits2::eTransferWrite);
+        barrier_image(memory::batch_cmd(vkctx.transfer, vkctx.device), *img.image, ImageAspectFlagBits::eColor, 0, mip_levels, 0, 1, ImageLayout::eUndefined, ImageLayout::eTransferDstOptimal, PipelineStageFlagBits2::eTopOfPipe, AccessFlags2{}, PipelineStageFlagBits2::eTransfer, AccessFlagBits2::eTransferWrite);
 
-        BufferImageCopy bic{};
-        bic.bufferOffset                    = 0;
-        bic.bufferRowLength                 = 0;
-        bic.bufferImageHeight               = 0;
-        bic.imageSubresource.aspectMask     = ImageAspectFlagBits::eColor;
-        bic.imageSubresource.mipLevel       = 0;
-        bic.imageSubresource.baseArrayLayer = 0;
-        bic.imageSubresource.layerCount     = 1;
-        bic.imageOffset                     = Offset3D{0, 0, 0};
-        bic.imageExtent                     = Extent3D{desc.width, desc.height, 1};
+        stage_rgba8_layers(vkctx, *img.image, rgba8, desc.width, desc.height, 1);
 
-        cmd.copyBufferToImage(*staging.buffer, *img.image, ImageLayout::eTransferDstOptimal, bic);
+        const auto& cmd = memory::batch_cmd(vkctx.transfer, vkctx.device);
 
         if (mip_levels == 1) {
             barrier_image(cmd, *img.image, ImageAspectFlagBits::eColor, 0, 1, 0, 1, ImageLayout::eTransferDstOptimal, ImageLayout::eShaderReadOnlyOptimal, PipelineStageFlagBits2::eTransfer, AccessFlagBits2::eTransferWrite, PipelineStageFlagBits2::eFragmentShader, AccessFlagBits2::eShaderSampledRead);
@@ -287,22 +224,22 @@ namespace vk::texture {
             barrier_image(cmd, *img.image, ImageAspectFlagBits::eColor, mip_levels - 1, 1, 0, 1, ImageLayout::eTransferDstOptimal, ImageLayout::eShaderReadOnlyOptimal, PipelineStageFlagBits2::eTransfer, AccessFlagBits2::eTransferWrite, PipelineStageFlagBits2::eFragmentShader, AccessFlagBits2::eShaderSampledRead);
         }
 
-        end_one_time(vkctx.graphics_queue, cmd);
+        memory::wait_ticket(vkctx.device, memory::flush(vkctx.transfer, vkctx.staging, vkctx.graphics_queue));
 
         Texture2D out{};
         out.format     = format;
         out.extent     = Extent2D{desc.width, desc.height};
         out.layers     = desc.layers;
         out.mip_levels = mip_levels;
+        out.allocation = std::move(img.allocation);
         out.image      = std::move(img.image);
-        out.memory     = std::move(img.memory);
         out.view       = create_view_2d(vkctx.device, *out.image, out.format, ImageAspectFlagBits::eColor, out.mip_levels);
         out.sampler    = create_sampler_2d(vkctx.device, desc, out.mip_levels);
 
         return out;
     }
 
-    Texture2DArray create_texture_2d_array_rgba8(const context::VulkanContext& vkctx, std::span<const std::byte> rgba8, Texture2DDesc desc) {
+    Texture2DArray create_texture_2d_array_rgba8(context::VulkanContext& vkctx, std::span<const std::byte> rgba8, Texture2DDesc desc) {
         if (desc.width == 0 || desc.height == 0 || desc.layers == 0) throw std::runtime_error("vk.texture: invalid extent/layers");
         if (desc.mip_mode != MipMode::None) throw std::runtime_error("vk.texture: mip generation for arrays not implemented");
         const size_t expected = size_t(desc.width) * size_t(desc.height) * size_t(desc.layers) * 4u;
@@ -311,54 +248,25 @@ namespace vk::texture {
         const Format format = desc.srgb ? Format::eR8G8B8A8Srgb : Format::eR8G8B8A8Unorm;
         const uint32_t mip_levels = 1;
 
-        const DeviceSize upload_size = DeviceSize(rgba8.size_bytes());
-
-        auto staging = create_buffer(vkctx.physical_device, vkctx.device, upload_size, BufferUsageFlagBits::eTransferSrc, MemoryPropertyFlagBits::eHostVisible | MemoryPropertyFlagBits::eHostCoherent);
-
-        {
-            void* dst = staging.memory.mapMemory(0, upload_size);
-            std::memcpy(dst, rgba8.data(), rgba8.size_bytes());
-            staging.memory.unmapMemory();
-        }
-
         ImageUsageFlags usage = ImageUsageFlagBits::eTransferDst | ImageUsageFlagBits::eSampled;
 
-        auto img = create_image_2d(vkctx.physical_device, vkctx.device, desc.width, desc.height, mip_levels, desc.layers, format, usage);
-
-        auto cmd = begin_one_time(vkctx.device, vkctx.command_pool);
-
-        barrier_image(cmd, *img.image, ImageAspectFlagBits::eColor, 0, mip_levels, 0, desc.layers, ImageLayout::eUndefined, ImageLayout::eTransferDstOptimal, PipelineStageFlagBits2::eTopOfPipe, AccessFlags2{}, PipelineStageFlagBits2::eTransfer, AccessFlagBits2::eTransferWrite);
-
-        std::vector<BufferImageCopy> regions;
-        regions.reserve(desc.layers);
-        const DeviceSize layer_stride = DeviceSize(size_t(desc.width) * size_t(desc.height) * 4u);
-        for (uint32_t layer = 0; layer < desc.layers; ++layer) {
-            BufferImageCopy bic{};
-            bic.bufferOffset                    = layer_stride * layer;
-            bic.bufferRowLength                 = 0;
-            bic.bufferImageHeight               = 0;
-            bic.imageSubresource.aspectMask     = ImageAspectFlagBits::eColor;
-            bic.imageSubresource.mipLevel       = 0;
-            bic.imageSubresource.baseArrayLayer = layer;
-            bic.imageSubresource.layerCount     = 1;
-            bic.imageOffset                     = Offset3D{0, 0, 0};
-            bic.imageExtent                     = Extent3D{desc.width, desc.height, 1};
-            regions.push_back(bic);
-        }
+        auto img = create_image_2d(vkctx.allocator, vkctx.device, desc.width, desc.height, mip_levels, desc.layers, format, usage);
+
+        barrier_image(memory::batch_cmd(vkctx.transfer, vkctx.device), *img.image, ImageAspectFlagBits::eColor, 0, mip_levels, 0, desc.layers, ImageLayout::eUndefined, ImageLayout::eTransferDstOptimal, PipelineStageFlagBits2::eTopOfPipe, AccessFlags2{}, PipelineStageFlagBits2::eTransfer, AccessFlagBits2::eTransferWrite);
 
-        cmd.copyBufferToImage(*staging.buffer, *img.image, ImageLayout::eTransferDstOptimal, regions);
+        stage_rgba8_layers(vkctx, *img.image, rgba8, desc.width, desc.height, desc.layers);
 
-        barrier_image(cmd, *img.image, ImageAspectFlagBits::eColor, 0, mip_levels, 0, desc.layers, ImageLayout::eTransferDstOptimal, ImageLayout::eShaderReadOnlyOptimal, PipelineStageFlagBits2::eTransfer, AccessFlagBits2::eTransferWrite, PipelineStageFlagBits2::eFragmentShader, AccessFlagBits2::eShaderSampledRead);
+        barrier_image(memory::batch_cmd(vkctx.transfer, vkctx.device), *img.image, ImageAspectFlagBits::eColor, 0, mip_levels, 0, desc.layers, ImageLayout::eTransferDstOptimal, ImageLayout::eShaderReadOnlyOptimal, PipelineStageFlagBits2::eTransfer, AccessFlagBits2::eTransferWrite, PipelineStageFlagBits2::eFragmentShader, AccessFlagBits2::eShaderSampledRead);
 
-        end_one_time(vkctx.graphics_queue, cmd);
+        memory::wait_ticket(vkctx.device, memory::flush(vkctx.transfer, vkctx.staging, vkctx.graphics_queue));
 
         Texture2DArray out{};
         out.format     = format;
         out.extent     = Extent2D{desc.width, desc.height};
         out.layers     = desc.layers;
         out.mip_levels = mip_levels;
+        out.allocation = std::move(img.allocation);
         out.image      = std::move(img.image);
-        out.memory     = std::move(img.memory);
         out.view       = create_view_2d_array(vkctx.device, *out.image, out.format, ImageAspectFlagBits::eColor, out.mip_levels, out.layers);
         out.sampler    = create_sampler_2d(vkctx.device, desc, out.mip_levels);
 